@@ -0,0 +1,230 @@
+// standard benchmark suite on fixed seeds, with the results as JSON
+// (see the 'bench' target of the makefile)
+//
+// usage: bench [scalar|sse2|avx2|avx512]
+// which limits the vectorized layer kernels to the given level
+#include "finders.h"
+#include "simd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *levelNames[] = { "scalar", "sse2", "avx2", "avx512" };
+static const char *mcNames[] = {
+    "1.7", "1.8", "1.9", "1.10", "1.11", "1.12", "1.13", "1.14", "1.15", "1.16"
+};
+
+// best time in seconds of a few runs, to reduce the noise
+#define BEST_OF(T, RUNS, CODE) \
+    do { \
+        int r_; (T) = 1e9; \
+        for (r_ = 0; r_ < (RUNS); r_++) { \
+            clock_t c_ = clock(); \
+            CODE; \
+            double t_ = (double)(clock() - c_) / CLOCKS_PER_SEC; \
+            if (t_ < (T)) (T) = t_; \
+        } \
+    } while (0)
+
+#define RUNS 3
+
+static int nresults;
+
+static void printResult(const char *name, int mc, const char *param,
+        const char *unit, double ops, double t)
+{
+    printf("%s\n    {\"name\":\"%s\",", nresults++ ? "," : "", name);
+    if (mc >= 0)
+        printf("\"mc\":\"%s\",", mcNames[mc]);
+    if (param)
+        printf("%s,", param);
+    printf("\"unit\":\"%s\",\"ops\":%.0f,\"seconds\":%.6f,\"rate\":%.1f}",
+            unit, ops, t, t > 0 ? ops / t : 0.0);
+    fflush(stdout);
+}
+
+static int benchPositions(LayerStack *g, int seeds)
+{
+    int64_t seed;
+    int sum = 0, i;
+    for (seed = 0; seed < seeds; seed++)
+    {
+        applySeed(g, seed);
+        for (i = 0; i < 16; i++)
+        {
+            Pos p = { (int)(seed * 7919 + i * 1543) % 20000 - 10000,
+                      (int)(seed * 4649 + i * 2711) % 20000 - 10000 };
+            sum += getBiomeAtPos(g, p);
+        }
+    }
+    return sum;
+}
+
+static int benchArea(LayerStack *g, Layer *l, int *buf, int size, int seeds)
+{
+    int64_t seed;
+    int sum = 0;
+    for (seed = 0; seed < seeds; seed++)
+    {
+        applySeed(g, seed);
+        genArea(l, buf, -size/2, -size/2, size, size);
+        sum += buf[seed & 0xff];
+    }
+    return sum;
+}
+
+static int benchStrongholds(LayerStack *g, int mc, int *cache, int seeds)
+{
+    Pos sh[3];
+    int64_t seed;
+    int sum = 0;
+    for (seed = 0; seed < seeds; seed++)
+    {
+        applySeed(g, seed);
+        sum += findStrongholds(mc, g, cache, sh, seed, 3, 0);
+        sum += sh[0].x;
+    }
+    return sum;
+}
+
+static int benchSpawn(LayerStack *g, int mc, int *cache, int seeds)
+{
+    int64_t seed;
+    int sum = 0;
+    for (seed = 0; seed < seeds; seed++)
+    {
+        applySeed(g, seed);
+        Pos p = getSpawn(mc, g, cache, seed);
+        sum += p.x + p.z;
+    }
+    return sum;
+}
+
+static int benchFilter(LayerStack *g, BiomeFilter filter, int *cache, int seeds)
+{
+    int64_t seed;
+    int sum = 0;
+    for (seed = 0; seed < seeds; seed++)
+        sum += checkForBiomes(g, L13_OCEAN_MIX_4, cache, seed,
+                -32, -32, 64, 64, filter, 1) > 0;
+    return sum;
+}
+
+// the check of a searchAll48() for quad-huts, run on a slice of the seeds
+static int benchQuadHuts(int64_t hiStart, int64_t hiCount)
+{
+    const int64_t *low = low20QuadClassic;
+    int nlow = sizeof(low20QuadClassic) / sizeof(*low);
+    int64_t hi;
+    int sum = 0, i;
+    for (hi = hiStart; hi < hiStart + hiCount; hi++)
+        for (i = 0; i < nlow; i++)
+            sum += isQuadBaseFeature24Classic(SWAMP_HUT_CONFIG, (hi << 20) | low[i]) != 0;
+    return sum;
+}
+
+
+int main(int argc, char **argv)
+{
+    int level = getSimdSupport();
+    int mc, i, sum = 0;
+    double t;
+    char param[128];
+
+    if (argc > 1)
+    {
+        for (i = 0; i < 4 && strcmp(argv[1], levelNames[i]) != 0; i++);
+        if (i == 4 || i > level)
+        {
+            fprintf(stderr, "bench: unsupported SIMD level '%s'\n", argv[1]);
+            return 1;
+        }
+        level = i;
+    }
+    setSimdLevel(level);
+
+    initBiomes();
+
+    LayerStack g;
+    const int areaSize = 256;
+    const int scales[] = { 256, 64, 16, 4, 1 };
+    const int areaSeeds[] = { 100, 100, 200, 100, 100 };
+
+    printf("{\"suite\":\"cubiomes\",\"simd\":\"%s\",\"results\":[", levelNames[level]);
+
+    for (mc = MC_1_7; mc <= MC_1_16; mc++)
+    {
+        setupGenerator(&g, mc);
+
+        BEST_OF(t, RUNS, sum += benchPositions(&g, 250));
+        printResult("getBiomeAtPos", mc, NULL, "positions", 250 * 16, t);
+
+        Layer *areas[] = {
+            &g.layers[L_BIOME_256], &g.layers[L_HILLS_64],
+            &g.layers[L_SHORE_16], g.entry_4, g.entry_1
+        };
+        int len = 0;
+        for (i = 0; i < 5; i++)
+        {
+            if (calcRequiredBuf(areas[i], areaSize, areaSize) > len)
+                len = calcRequiredBuf(areas[i], areaSize, areaSize);
+        }
+        int *buf = (int *) calloc(len, sizeof(int));
+
+        for (i = 0; i < 5; i++)
+        {
+            BEST_OF(t, RUNS, sum += benchArea(&g, areas[i], buf, areaSize, areaSeeds[i]));
+            snprintf(param, sizeof(param), "\"scale\":%d,\"size\":%d", scales[i], areaSize);
+            printResult("genArea", mc, param, "cells",
+                    (double)areaSeeds[i] * areaSize * areaSize, t);
+        }
+        free(buf);
+    }
+
+    int versions[] = { MC_1_12, MC_1_16 };
+    for (i = 0; i < 2; i++)
+    {
+        mc = versions[i];
+        setupGenerator(&g, mc);
+        int *cache = allocCache(g.entry_4, 256, 256);
+
+        BEST_OF(t, RUNS, sum += benchStrongholds(&g, mc, cache, 400));
+        printResult("findStrongholds", mc, "\"strongholds\":3", "seeds", 400, t);
+
+        BEST_OF(t, RUNS, sum += benchSpawn(&g, mc, cache, 200));
+        printResult("getSpawn", mc, NULL, "seeds", 200, t);
+
+        free(cache);
+    }
+
+    {
+        const int filterJungle[] = { jungle, mushroom_fields };
+        const int filterOcean[] = { warm_ocean, deep_frozen_ocean, ice_spikes };
+        struct { const char *name; const int *ids; int len, seeds; } filters[] = {
+            { "jungle+mushroom_fields", filterJungle, 2, 100000 },
+            { "warm_ocean+deep_frozen_ocean+ice_spikes", filterOcean, 3, 10000 },
+        };
+
+        setupGenerator(&g, MC_1_16);
+        int *cache = allocCache(g.entry_4, 64, 64);
+        for (i = 0; i < 2; i++)
+        {
+            BiomeFilter filter = setupBiomeFilter(filters[i].ids, filters[i].len);
+            BEST_OF(t, RUNS, sum += benchFilter(&g, filter, cache, filters[i].seeds));
+            snprintf(param, sizeof(param), "\"filter\":\"%s\"", filters[i].name);
+            printResult("checkForBiomes", MC_1_16, param, "seeds", filters[i].seeds, t);
+        }
+        free(cache);
+    }
+
+    BEST_OF(t, RUNS, sum += benchQuadHuts(1LL << 20, 1 << 22));
+    printResult("searchAll48 quad-hut slice", -1,
+            "\"lowBits\":\"low20QuadClassic\"", "seeds",
+            (double)(1 << 22) * (sizeof(low20QuadClassic) / sizeof(int64_t)), t);
+
+    printf("\n]}\n");
+
+    setSimdLevel(-1);
+    return sum == 0x7fffffff; // keep the results alive
+}
@@ -0,0 +1,575 @@
+// bit-exact regression check of the generator (see the 'check' target of the
+// makefile)
+//
+// usage: check [golden] [-g]
+// Hashes the output of the scalar generator for a fixed corpus of seeds: the
+// areas of every layer of every version, the structure positions and their
+// viability, the strongholds and the spawn. The hashes are compared against
+// the golden hashes in the file 'golden' (check.txt), or printed with -g to
+// update them. Afterwards every alternative implementation in the library is
+// compared against the scalar genArea(): the SIMD levels, workspaces, layer
+// contexts, the tiled, streamed, packed, cached, viewport, tap and masked
+// generation, the point queries and the seed-parallel lanes, for the default
+// and the large biomes stacks, near and far from the origin.
+#include "finders.h"
+#include "multiseed.h"
+#include "profile.h"
+#include "simd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *mcNames[] = {
+    "1.7", "1.8", "1.9", "1.10", "1.11", "1.12", "1.13", "1.14", "1.15", "1.16"
+};
+static const char *levelNames[] = { "scalar", "sse2", "avx2", "avx512" };
+
+static const int64_t seeds[] = {
+    0, 1, -1, 123456789, 3055141959546LL, -6972403845611236871LL,
+};
+#define NSEEDS  (int)(sizeof(seeds) / sizeof(*seeds))
+
+// area in cells of each layer
+#define AREA_X  -20
+#define AREA_Z  13
+#define AREA_W  48
+#define AREA_H  40
+// second area of the golden hashes, far from the origin
+#define FAR_X   -300017
+#define FAR_Z   299993
+
+// areas in cells on which the alternative implementations are compared
+STRUCT(PathArea)
+{
+    const char *name;
+    int x, z, w, h;
+};
+
+static const PathArea pathAreas[] = {
+    { "near", AREA_X, AREA_Z, AREA_W, AREA_H },
+    // beyond 1e6 blocks at every scale, where the zoom paths drift apart
+    { "far", -1000003, 1000033, 40, 36 },
+    // rows long enough for the polynomial chunk seeds of the SIMD kernels
+    { "wide", -171, 29, 288, 5 },
+};
+#define NPATHAREAS  (int)(sizeof(pathAreas) / sizeof(*pathAreas))
+
+
+//==============================================================================
+// Golden Hashes
+//==============================================================================
+
+STRUCT(Golden)
+{
+    char key[64];
+    uint64_t hash;
+};
+
+static Golden *golden;
+static int ngolden, nhashes, nfailed;
+
+static uint64_t hashInts(uint64_t h, const int *v, size_t n)
+{
+    // FNV-1a over the bytes of the values, independent of the endianness
+    size_t i;
+    int k;
+    for (i = 0; i < n; i++)
+    {
+        for (k = 0; k < 32; k += 8)
+        {
+            h ^= ((uint32_t)v[i] >> k) & 0xff;
+            h *= 0x100000001b3ULL;
+        }
+    }
+    return h;
+}
+
+#define HASH_INIT 0xcbf29ce484222325ULL
+
+static void loadGolden(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char line[128];
+    unsigned long long h;
+    int cap = 0;
+
+    if (!fp)
+    {
+        fprintf(stderr, "check: cannot open '%s'\n", path);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (ngolden == cap)
+        {
+            cap = cap ? 2 * cap : 1024;
+            golden = (Golden *) realloc(golden, cap * sizeof(Golden));
+            if (!golden)
+                exit(1);
+        }
+        char *sp = strrchr(line, ' ');
+        if (!sp || sp - line >= (int)sizeof(golden->key) ||
+            sscanf(sp + 1, "%llx", &h) != 1)
+            continue;
+        memcpy(golden[ngolden].key, line, sp - line);
+        golden[ngolden].key[sp - line] = 0;
+        golden[ngolden].hash = h;
+        ngolden++;
+    }
+    fclose(fp);
+}
+
+static void checkHash(const char *key, uint64_t hash)
+{
+    int i;
+    nhashes++;
+    if (!golden)
+    {
+        printf("%s %016llx\n", key, (unsigned long long) hash);
+        return;
+    }
+    for (i = 0; i < ngolden; i++)
+    {
+        if (strcmp(golden[i].key, key) == 0)
+        {
+            if (golden[i].hash != hash)
+            {
+                printf("FAIL %s: %016llx, golden %016llx\n", key,
+                    (unsigned long long) hash, (unsigned long long) golden[i].hash);
+                nfailed++;
+            }
+            return;
+        }
+    }
+    printf("FAIL %s: no golden hash\n", key);
+    nfailed++;
+}
+
+static void setupStack(LayerStack *g, int mc, int large)
+{
+    if (large)
+        setupLargeBiomesGenerator(g, mc);
+    else
+        setupGenerator(g, mc);
+}
+
+static void hashAreas(int mc, int large)
+{
+    LayerStack g;
+    char key[64];
+    int i, s;
+
+    setupStack(&g, mc, large);
+    for (i = 0; i < L_NUM; i++)
+    {
+        Layer *l = &g.layers[i];
+        if (!l->getMap)
+            continue;
+        int *buf = allocCache(l, AREA_W, AREA_H);
+        uint64_t h = HASH_INIT;
+        for (s = 0; s < NSEEDS; s++)
+        {
+            applySeed(&g, seeds[s]);
+            if (genArea(l, buf, AREA_X, AREA_Z, AREA_W, AREA_H))
+                buf[0] = -1;
+            h = hashInts(h, buf, AREA_W * AREA_H);
+            if (genArea(l, buf, FAR_X, FAR_Z, AREA_W, AREA_H))
+                buf[0] = -1;
+            h = hashInts(h, buf, AREA_W * AREA_H);
+        }
+        free(buf);
+        snprintf(key, sizeof(key), "area %s%s %s", mcNames[mc],
+            large ? "-large" : "", getProfileLayerName(i));
+        checkHash(key, h);
+    }
+}
+
+static void hashStructures(int mc)
+{
+    LayerStack g;
+    char key[64];
+    int st, s, rx, rz;
+
+    setupGenerator(&g, mc);
+    for (st = Feature; st <= End_City; st++)
+    {
+        uint64_t h = HASH_INIT;
+        for (s = 0; s < NSEEDS; s++)
+        {
+            for (rz = -2; rz < 2; rz++)
+            {
+                for (rx = -2; rx < 2; rx++)
+                {
+                    Pos p = {0, 0};
+                    int v[4] = { getStructurePos(st, mc, seeds[s], rx, rz, &p), 0 };
+                    v[1] = p.x;
+                    v[2] = p.z;
+                    if (v[0] && st > Feature && st < Fortress)
+                        v[3] = isViableStructurePos(st, mc, &g, seeds[s], p.x, p.z);
+                    h = hashInts(h, v, 4);
+                }
+            }
+        }
+        snprintf(key, sizeof(key), "structure %s %d", mcNames[mc], st);
+        checkHash(key, h);
+    }
+}
+
+static void hashStrongholdsSpawn(int mc)
+{
+    LayerStack g;
+    char key[64];
+    int s, n;
+    uint64_t hsh = HASH_INIT, hsp = HASH_INIT;
+
+    setupGenerator(&g, mc);
+    int *cache = allocCache(g.entry_4, 256, 256);
+    for (s = 0; s < NSEEDS; s++)
+    {
+        Pos sh[3];
+        applySeed(&g, seeds[s]);
+        memset(sh, 0, sizeof(sh));
+        n = findStrongholds(mc, &g, cache, sh, seeds[s], 3, 0);
+        hsh = hashInts(hsh, &n, 1);
+        hsh = hashInts(hsh, (const int *) sh, 2 * 3);
+        Pos sp = getSpawn(mc, &g, cache, seeds[s]);
+        hsp = hashInts(hsp, (const int *) &sp, 2);
+    }
+    free(cache);
+    snprintf(key, sizeof(key), "strongholds %s", mcNames[mc]);
+    checkHash(key, hsh);
+    snprintf(key, sizeof(key), "spawn %s", mcNames[mc]);
+    checkHash(key, hsp);
+}
+
+
+//==============================================================================
+// Alternative Implementations
+//==============================================================================
+
+static int npaths, npathsFailed;
+static const char *pathCase = "";   // stack and area of the failures
+
+static void checkPath(const char *path, int mc, int layer, int64_t seed, int ok)
+{
+    npaths++;
+    if (ok)
+        return;
+    npathsFailed++;
+    printf("FAIL %s: %s%s %s seed %lld\n", path, mcNames[mc], pathCase,
+        layer >= 0 ? getProfileLayerName(layer) : "-", (long long) seed);
+}
+
+static int sameArea(const PathArea *pa, const int *a, const int *b)
+{
+    return memcmp(a, b, pa->w * pa->h * sizeof(int)) == 0;
+}
+
+STRUCT(StreamCopy)
+{
+    const PathArea *pa;
+    int *out;
+};
+
+static int copyStrip(void *data, const int *ids, int x, int z, int w, int h)
+{
+    StreamCopy *sc = (StreamCopy *) data;
+    const PathArea *pa = sc->pa;
+    int j;
+    for (j = 0; j < h; j++)
+        memcpy(sc->out + (x - pa->x) + (z - pa->z + j) * pa->w,
+            ids + j * w, w * sizeof(int));
+    return 0;
+}
+
+/* Compares the generation of one layer by every alternative implementation
+ * against the scalar reference 'ref' of the layer.
+ */
+static void checkLayerPaths(LayerStack *g, const PathArea *pa, int mc, int id,
+        int64_t seed, const int *ref)
+{
+    Layer *l = &g->layers[id];
+    int n = pa->w * pa->h;
+    int *out = (int *) malloc(n * sizeof(int));
+    int *buf = allocCache(l, pa->w, pa->h);
+    int i, j, level, ok;
+
+    // vectorized kernels
+    for (level = SIMD_NONE + 1; level <= getSimdSupport(); level++)
+    {
+        setSimdLevel(level);
+        ok = genArea(l, buf, pa->x, pa->z, pa->w, pa->h) == 0 && sameArea(pa, buf, ref);
+        checkPath(levelNames[level], mc, id, seed, ok);
+    }
+    setSimdLevel(SIMD_NONE);
+
+    // workspace with the exact plan
+    LayerWorkspace ws;
+    initWorkspace(&ws);
+    ok = genAreaWs(l, &ws, pa->x, pa->z, pa->w, pa->h) == 0 && sameArea(pa, ws.buf, ref);
+    checkPath("genAreaWs", mc, id, seed, ok);
+    freeWorkspace(&ws);
+
+    // layer context over the shared generator
+    LayerContext *ctx = (LayerContext *) malloc(sizeof(LayerContext));
+    initLayerContext(ctx, g);
+    applyContextSeed(ctx, seed);
+    ok = genArea(&ctx->stack.layers[id], buf, pa->x, pa->z, pa->w, pa->h) == 0 &&
+        sameArea(pa, buf, ref);
+    checkPath("LayerContext", mc, id, seed, ok);
+    free(ctx);
+
+    // tiles on several threads
+    ok = genAreaParallel(l, out, pa->x, pa->z, pa->w, pa->h, 16, 3) == 0 &&
+        sameArea(pa, out, ref);
+    checkPath("genAreaParallel", mc, id, seed, ok);
+
+    // streamed in bands and strips
+    StreamCopy sc = { pa, out };
+    memset(out, 0, n * sizeof(int));
+    ok = genAreaStream(l, pa->x, pa->z, pa->w, pa->h, 20, 7, copyStrip, &sc) == 0 &&
+        sameArea(pa, out, ref);
+    checkPath("genAreaStream", mc, id, seed, ok);
+
+    // packed output
+    int cb = getLayerCellBytes(l);
+    void *packed = malloc(n * cb);
+    ok = genAreaPacked(l, packed, cb, pa->x, pa->z, pa->w, pa->h) == 0;
+    for (i = 0; ok && i < n; i++)
+    {
+        int v = cb == 1 ? ((uint8_t *) packed)[i] :
+                cb == 2 ? ((uint16_t *) packed)[i] : ((int *) packed)[i];
+        ok = v == ref[i];
+    }
+    checkPath("genAreaPacked", mc, id, seed, ok);
+    free(packed);
+
+    // viewport, moved onto the area from an overlapping one
+    Viewport *vp = createViewport(l, pa->w, pa->h);
+    ok = vp != NULL;
+    if (ok)
+    {
+        const int *ids = moveViewport(vp, pa->x - 5, pa->z + 3);
+        ok = ids != NULL;
+        ids = ok ? moveViewport(vp, pa->x, pa->z) : NULL;
+        ok = ids != NULL && sameArea(pa, ids, ref);
+        freeViewport(vp);
+    }
+    checkPath("Viewport", mc, id, seed, ok);
+
+    // tap together with the parents of the layer
+    LayerTap taps[3] = {
+        { l, out, pa->x, pa->z, pa->w, pa->h },
+    };
+    int ntaps = 1;
+    int *pout[2] = { NULL, NULL };
+    if (l->p)
+    {
+        pout[0] = (int *) malloc(n * sizeof(int));
+        LayerTap t = { l->p, pout[0], pa->x / 2, pa->z / 2, pa->w / 2, pa->h / 2 };
+        taps[ntaps++] = t;
+    }
+    if (l->p2)
+    {
+        pout[1] = (int *) malloc(n * sizeof(int));
+        LayerTap t = { l->p2, pout[1], pa->x, pa->z, pa->w, pa->h };
+        taps[ntaps++] = t;
+    }
+    ok = genAreaTaps(taps, ntaps) == 0 && sameArea(pa, out, ref);
+    for (i = 1; ok && i < ntaps; i++)
+    {
+        const LayerTap *t = &taps[i];
+        int *pref = allocCache(t->layer, t->w, t->h);
+        ok = genArea(t->layer, pref, t->x, t->z, t->w, t->h) == 0 &&
+            memcmp(pref, t->out, t->w * t->h * sizeof(int)) == 0;
+        free(pref);
+    }
+    checkPath("genAreaTaps", mc, id, seed, ok);
+    free(pout[0]);
+    free(pout[1]);
+
+    // masked generation of a disc
+    uint8_t *mask = (uint8_t *) calloc(n, 1);
+    for (j = 0; j < pa->h; j++)
+    {
+        for (i = 0; i < pa->w; i++)
+        {
+            int dx = 2*i - pa->w, dz = 2*j - pa->h;
+            mask[i + j*pa->w] = dx*dx + dz*dz < pa->h*pa->h;
+        }
+    }
+    ok = genAreaMasked(l, out, mask, pa->x, pa->z, pa->w, pa->h) == 0;
+    for (i = 0; ok && i < n; i++)
+        ok = !mask[i] || out[i] == ref[i];
+    checkPath("genAreaMasked", mc, id, seed, ok);
+    free(mask);
+
+    // point queries
+    int pos[2*16], pts[16];
+    for (i = 0; i < 16; i++)
+    {
+        pos[2*i+0] = pa->x + (i * 7) % pa->w;
+        pos[2*i+1] = pa->z + (i * 13) % pa->h;
+    }
+    ok = genPoints(l, pts, pos, 16) == 0;
+    for (i = 0; ok && i < 16; i++)
+    {
+        int v = -1;
+        int k = (pos[2*i] - pa->x) + (pos[2*i+1] - pa->z) * pa->w;
+        ok = pts[i] == ref[k] &&
+            genPoint(l, &v, pos[2*i], pos[2*i+1]) == 0 && v == ref[k];
+    }
+    checkPath("genPoint", mc, id, seed, ok);
+
+    free(buf);
+    free(out);
+}
+
+/* Compares the tile cache, the seed-parallel lanes and the biome queries of
+ * the generator against the scalar reference.
+ */
+static void checkGeneratorPaths(LayerStack *g, const PathArea *pa, int mc,
+        int64_t seed)
+{
+    int n = pa->w * pa->h;
+    int *ref = allocCache(g->entry_1, pa->w, pa->h);
+    int *buf = allocCache(g->entry_1, pa->w, pa->h);
+    int i, k, ok;
+
+    applySeed(g, seed);
+    genArea(g->entry_1, ref, pa->x, pa->z, pa->w, pa->h);
+
+    // biome queries at block positions
+    Pos pos[16];
+    int ids[16];
+    for (i = 0; i < 16; i++)
+    {
+        pos[i].x = pa->x + (i * 11) % pa->w;
+        pos[i].z = pa->z + (i * 5) % pa->h;
+    }
+    ok = getBiomesAtPositions(g, pos, 16, ids) == 0;
+    for (i = 0; ok && i < 16; i++)
+    {
+        int r = ref[(pos[i].x - pa->x) + (pos[i].z - pa->z) * pa->w];
+        ok = ids[i] == r && getBiomeAtPos(g, pos[i]) == r;
+    }
+    checkPath("getBiomeAtPos", mc, -1, seed, ok);
+
+    // tile cache on layers along the graph
+    TileCache tc;
+    int cached[] = { L_ZOOM_1024, L_BIOME_256, L_SHORE_16 };
+    ok = initTileCache(&tc, 16, 1 << 20) == 0;
+    for (i = 0; ok && i < 3; i++)
+        ok = attachTileCache(&tc, &g->layers[cached[i]]) == 0;
+    for (k = 0; ok && k < 2; k++)
+        ok = genArea(g->entry_1, buf, pa->x, pa->z, pa->w, pa->h) == 0 &&
+            sameArea(pa, buf, ref);
+    freeTileCache(&tc);
+    checkPath("TileCache", mc, -1, seed, ok);
+
+    free(ref);
+    free(buf);
+
+    // seed-parallel lanes
+    MultiSeed ms;
+    int64_t lanes[MS_LANES];
+    for (k = 0; k < MS_LANES; k++)
+        lanes[k] = seed + k * 0x9e3779b97f4a7c15LL;
+    setupMultiSeed(&ms, g, lanes, MS_LANES);
+    for (i = 0; i < L_NUM; i++)
+    {
+        Layer *l = &g->layers[i];
+        if (!l->getMap)
+            continue;
+        int *mout = allocCacheMulti(l, pa->w, pa->h);
+        int *lref = allocCache(l, pa->w, pa->h);
+        ok = genAreaMulti(&ms, l, mout, pa->x, pa->z, pa->w, pa->h) == 0;
+        for (k = 0; ok && k < MS_LANES; k++)
+        {
+            applySeed(g, lanes[k]);
+            genArea(l, lref, pa->x, pa->z, pa->w, pa->h);
+            int c;
+            for (c = 0; ok && c < n; c++)
+                ok = mout[c * MS_LANES + k] == lref[c];
+        }
+        checkPath("genAreaMulti", mc, i, seed, ok);
+        free(mout);
+        free(lref);
+    }
+}
+
+static void checkPaths(int mc, int large)
+{
+    LayerStack g;
+    char label[32];
+    int a, i, s;
+
+    setupStack(&g, mc, large);
+    for (a = 0; a < NPATHAREAS; a++)
+    {
+        const PathArea *pa = &pathAreas[a];
+        snprintf(label, sizeof(label), "%s %s", large ? "-large" : "", pa->name);
+        pathCase = label;
+        for (s = 0; s < 2; s++)
+        {
+            int64_t seed = seeds[NSEEDS - 1 - s];
+            for (i = 0; i < L_NUM; i++)
+            {
+                Layer *l = &g.layers[i];
+                if (!l->getMap)
+                    continue;
+                int *ref = allocCache(l, pa->w, pa->h);
+                applySeed(&g, seed);
+                genArea(l, ref, pa->x, pa->z, pa->w, pa->h);
+                checkLayerPaths(&g, pa, mc, i, seed, ref);
+                free(ref);
+            }
+            checkGeneratorPaths(&g, pa, mc, seed);
+        }
+    }
+    pathCase = "";
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *path = "check.txt";
+    int print = 0, mc, i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-g") == 0)
+            print = 1;
+        else
+            path = argv[i];
+    }
+    if (!print)
+        loadGolden(path);
+
+    initBiomes();
+    setSimdLevel(SIMD_NONE);
+
+    for (mc = MC_1_7; mc <= MC_1_16; mc++)
+    {
+        hashAreas(mc, 0);
+        hashAreas(mc, 1);
+        hashStructures(mc);
+        hashStrongholdsSpawn(mc);
+    }
+    if (print)
+        return 0;
+
+    for (mc = MC_1_7; mc <= MC_1_16; mc++)
+    {
+        checkPaths(mc, 0);
+        checkPaths(mc, 1);
+    }
+
+    setSimdLevel(-1);
+    free(golden);
+
+    printf("check: %d/%d golden hashes, %d/%d alternative paths %s\n",
+        nhashes - nfailed, nhashes, npaths - npathsFailed, npaths,
+        nfailed || npathsFailed ? "FAILED" : "OK");
+    return nfailed || npathsFailed;
+}
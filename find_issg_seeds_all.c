@@ -175,9 +175,14 @@ bool getPlainsVillageForGivenRegion(SSP ssp, LayerStack* layerAddress, int x, in
 //        printf("found village at %d, %d in region %d, %d\n", villagePos.x, villagePos.z, x, z);
 
         if (isViableStructurePos(villageType, MC, layerAddress, ssp.seed, x, z)) {
-            Pos villageBiomePos = { villagePos.x + 8, villagePos.z + 8 };
-            int villagePosBiomeId = getBiomeAtPos(layerAddress, villagePos);
-            int villageBiomePosBiomeId = getBiomeAtPos(layerAddress, villageBiomePos);
+            Pos villageBiomePos[] = {
+                    villagePos,
+                    { villagePos.x + 8, villagePos.z + 8 },
+            };
+            int villageBiomeIds[2];
+            getBiomesAtPositions(layerAddress, villageBiomePos, 2, villageBiomeIds);
+            int villagePosBiomeId = villageBiomeIds[0];
+            int villageBiomePosBiomeId = villageBiomeIds[1];
 
             if (DEBUG) {
                 printf("villageBiome: %d\n", villagePosBiomeId);
@@ -433,17 +438,15 @@ bool isOcean(LayerStack* layerAddress, Pos pos) {
     int x = pos.x;
     int z = pos.z;
 
-    Pos pn = {x+8, z};
-    Pos ps = {x-8, z};
-    Pos pe = {x, z+8};
-    Pos pw = {x, z-8};
-    int localCords[] = {
-            getBiomeAtPos(layerAddress, pos),
-            getBiomeAtPos(layerAddress, pn),
-            getBiomeAtPos(layerAddress, ps),
-            getBiomeAtPos(layerAddress, pe),
-            getBiomeAtPos(layerAddress, pw),
+    Pos localPos[] = {
+            pos,
+            {x+8, z},
+            {x-8, z},
+            {x, z+8},
+            {x, z-8},
     };
+    int localCords[5];
+    getBiomesAtPositions(layerAddress, localPos, 5, localCords);
 
     for (int i = 0; i < 5; i++) {
         if (
@@ -809,13 +809,26 @@ int scanForQuads(
 
 int getBiomeAtPos(const LayerStack *g, const Pos pos)
 {
+    int biomeID = none;
+    if L(genPoint(g->entry_1, &biomeID, pos.x, pos.z) == 0)
+        return biomeID;
+
+    // the point query failed to allocate its windows
     int *map = allocCache(g->entry_1, 1, 1);
-    genArea(g->entry_1, map, pos.x, pos.z, 1, 1);
-    int biomeID = map[0];
+    if (map == NULL)
+        return none;
+    if (genArea(g->entry_1, map, pos.x, pos.z, 1, 1) == 0)
+        biomeID = map[0];
     free(map);
     return biomeID;
 }
 
+int getBiomesAtPositions(const LayerStack *g, const Pos *pos, int n, int *out)
+{
+    // the positions are laid out as consecutive (x,z) pairs
+    return genPoints(g->entry_1, out, &pos->x, n);
+}
+
 Pos findBiomePosition(
         const int mcversion,
         const Layer *l,
@@ -1605,6 +1618,7 @@ int isViableStructurePos(int structureType, int mc, LayerStack *g,
     // In 1.16 the biome check is always performed at (2,2) with layer scale=4.
     int biomeX, biomeZ;
 
+    // the filters are only swapped in, so the seeds of the layers remain
     Layer lbiome = g->layers[L_BIOME_256];
     Layer lshore = g->layers[L_SHORE_16];
 
@@ -1774,8 +1788,10 @@ L_viable:
         viable = 1;
 L_not_viable:
 
-    g->layers[L_BIOME_256] = lbiome;
-    g->layers[L_SHORE_16] = lshore;
+    g->layers[L_BIOME_256].getMap = lbiome.getMap;
+    g->layers[L_BIOME_256].data = lbiome.data;
+    g->layers[L_SHORE_16].getMap = lshore.getMap;
+    g->layers[L_SHORE_16].data = lshore.data;
     if (map)
         free(map);
 
@@ -2176,8 +2192,37 @@ STRUCT(filter_data_t)
 {
     const BiomeFilter *bf;
     int (*map)(const Layer *, int *, int, int, int, int);
+    // biomes required at the end of the generation, for the potential check
+    uint64_t potL, potM;
+    int mc;
 };
 
+/* The area that a layer generates covers every cell that the requested area
+ * depends on, so each biome that is required at the end of the generation
+ * has to descend from one of the biomes 'b' (ids 0-63) or 'bm' (ids 128-191)
+ * of the layer area (see genPotential()).
+ * Returns non-zero if a required biome cannot appear in the requested area.
+ */
+static int lacksPotential(const filter_data_t *f, int layer, uint64_t b, uint64_t bm)
+{
+    uint64_t mL = 0, mM = 0;
+    int i;
+
+    if (!(f->potL | f->potM))
+        return 0;
+
+    for (i = 0; i < 64; i++)
+    {
+        if (b & (1ULL << i))
+            genPotential(&mL, &mM, layer, f->mc, i);
+        if (bm & (1ULL << i))
+            genPotential(&mL, &mM, layer, f->mc, i + 128);
+        if (!(f->potL & ~mL) && !(f->potM & ~mM))
+            return 0;
+    }
+    return 1;
+}
+
 static int mapFilterSpecial(const Layer * l, int * out, int x, int z, int w, int h)
 {
     const filter_data_t *f = (const filter_data_t*) l->data;
@@ -2289,7 +2334,7 @@ static int mapFilterBiome(const Layer * l, int * out, int x, int z, int w, int h
 
     if ((b & f->bf->majorToFind) ^ f->bf->majorToFind)
         return 1;
-    return 0;
+    return lacksPotential(f, L_BIOME_256, b, 0);
 }
 
 static int mapFilterOceanTemp(const Layer * l, int * out, int x, int z, int w, int h)
@@ -2320,7 +2365,7 @@ static int mapFilterOceanTemp(const Layer * l, int * out, int x, int z, int w, i
 static int mapFilterBiomeEdge(const Layer * l, int * out, int x, int z, int w, int h)
 {
     const filter_data_t *f = (const filter_data_t*) l->data;
-    uint64_t b;
+    uint64_t b, bl, bm;
     int i;
     int err;
 
@@ -2328,13 +2373,18 @@ static int mapFilterBiomeEdge(const Layer * l, int * out, int x, int z, int w, i
     if U(err != 0)
         return err;
 
-    b = 0;
+    b = 0; bl = 0; bm = 0;
     for (i = 0; i < w*h; i++)
-        b |= (1ULL << (out[i] & 0x3f));
+    {
+        int id = out[i];
+        b |= (1ULL << (id & 0x3f));
+        if (id < 128) bl |= (1ULL << id);
+        else bm |= (1ULL << (id-128));
+    }
 
     if ((b & f->bf->edgesToFind) ^ f->bf->edgesToFind)
         return 1;
-    return 0;
+    return lacksPotential(f, L_BIOME_EDGE_64, bl, bm);
 }
 
 static int mapFilterRareBiome(const Layer * l, int * out, int x, int z, int w, int h)
@@ -2360,7 +2410,7 @@ static int mapFilterRareBiome(const Layer * l, int * out, int x, int z, int w, i
         return 1;
     if ((bm & f->bf->raresToFindM) ^ f->bf->raresToFindM)
         return 1;
-    return 0;
+    return lacksPotential(f, L_RARE_BIOME_64, b, bm);
 }
 
 static int mapFilterShore(const Layer * l, int * out, int x, int z, int w, int h)
@@ -2385,7 +2435,7 @@ static int mapFilterShore(const Layer * l, int * out, int x, int z, int w, int h
         return 1;
     if ((bm & f->bf->shoreToFindM) ^ f->bf->shoreToFindM)
         return 1;
-    return 0;
+    return lacksPotential(f, L_SHORE_16, b, bm);
 }
 
 static int mapFilterRiverMix(const Layer * l, int * out, int x, int z, int w, int h)
@@ -2422,7 +2472,7 @@ static int mapFilterOceanMix(const Layer * l, int * out, int x, int z, int w, in
 
     if (f->bf->riverToFind)
     {
-        err = l->p->getMap(l->p, out, x, z, w, h); // RiverMix
+        err = getLayerMap(l->p, out, x, z, w, h); // RiverMix
         if (err)
             return err;
     }
@@ -2459,6 +2509,20 @@ void restoreMap(filter_data_t *fd, Layer *l)
 }
 
 
+/* The version that genPotential() assumes for the layers of a generator: the
+ * potentials only differ between 1.12, 1.13 and 1.14, which are told apart by
+ * their hills, ocean and bamboo layers.
+ */
+static int getPotentialVersion(const LayerStack *g)
+{
+    const Layer *l = g->layers;
+    if (l[L_HILLS_64].getMap == mapHills112)
+        return MC_1_12;
+    if (l[L_ZOOM_128].p == &l[L14_BAMBOO_256])
+        return MC_1_14;
+    return MC_1_13;
+}
+
 int checkForBiomes(
         LayerStack *    g,
         int             layerID,
@@ -2575,6 +2639,7 @@ L_HAS_PROTO_MUSHROOM:
 
     l = g->layers;
     int *map = cache ? cache : allocCache(&l[layerID], w, h);
+    int i;
 
     filter_data_t fd[9];
     swapMap(fd+0, &filter, l+L13_OCEAN_MIX_4,       mapFilterOceanMix);
@@ -2587,13 +2652,24 @@ L_HAS_PROTO_MUSHROOM:
     swapMap(fd+7, &filter, l+L_ADD_MUSHROOM_256,    mapFilterMushroom);
     swapMap(fd+8, &filter, l+L_SPECIAL_1024,        mapFilterSpecial);
 
+    // rivers come from the river chain, which genPotential() leaves out
+    uint64_t potL = filter.riverToFind;
+    potL &= ~((1ULL << ocean) | (1ULL << deep_ocean) | (1ULL << river));
+    potL |= filter.oceanToFind;
+    int mc = getPotentialVersion(g);
+    for (i = 0; i < 9; i++)
+    {
+        fd[i].potL = potL;
+        fd[i].potM = filter.riverToFindM;
+        fd[i].mc = mc;
+    }
+
     setLayerSeed(&l[layerID], seed);
-    int ret = !l[layerID].getMap(&l[layerID], map, x, z, w, h);
+    int ret = !getLayerMap(&l[layerID], map, x, z, w, h);
     if (ret)
     {
         uint64_t required, b = 0, bm = 0;
-        unsigned int i;
-        for (i = 0; i < w*h; i++)
+        for (i = 0; i < (int)(w*h); i++)
         {
             int id = map[i];
             if (id < 128) b |= (1ULL << id);
@@ -2751,7 +2827,7 @@ void genPotential(uint64_t *mL, uint64_t *mM, int layer, int mc, int id)
         break;
 
     case L_BIOME_256: // biomes added in (L_BIOME_256, L_BIOME_EDGE_64]
-        for (i = sizeof(BIOMES_L_BIOME_256) / sizeof(int); i >= 0; i--)
+        for (i = sizeof(BIOMES_L_BIOME_256) / sizeof(int) - 1; i >= 0; i--)
             if (BIOMES_L_BIOME_256[i] == id)
                 break;
         if (i < 0) break;
@@ -2771,7 +2847,7 @@ void genPotential(uint64_t *mL, uint64_t *mM, int layer, int mc, int id)
         break;
 
     case L_BIOME_EDGE_64: // biomes added in (L_BIOME_EDGE_64, L_HILLS_64]
-        for (i = sizeof(BIOMES_L_BIOME_EDGE_64) / sizeof(int); i >= 0; i--)
+        for (i = sizeof(BIOMES_L_BIOME_EDGE_64) / sizeof(int) - 1; i >= 0; i--)
             if (BIOMES_L_BIOME_EDGE_64[i] == id)
                 break;
         if (i < 0) break;
@@ -2796,6 +2872,12 @@ void genPotential(uint64_t *mL, uint64_t *mM, int layer, int mc, int id)
         case taiga:
             genPotential(mL, mM, L_HILLS_64, mc, taiga_hills);
             break;
+        case snowy_taiga:
+            genPotential(mL, mM, L_HILLS_64, mc, snowy_taiga_hills);
+            break;
+        case jungle:
+            genPotential(mL, mM, L_HILLS_64, mc, jungle_hills);
+            break;
         case giant_tree_taiga:
             genPotential(mL, mM, L_HILLS_64, mc, giant_tree_taiga_hills);
             genPotential(mL, mM, L_HILLS_64, mc, biomes[giant_tree_taiga_hills].mutated);
@@ -2841,7 +2923,7 @@ void genPotential(uint64_t *mL, uint64_t *mM, int layer, int mc, int id)
         break;
 
     case L_HILLS_64: // biomes added in (L_HILLS_64, L_RARE_BIOME_64]
-        for (i = sizeof(BIOMES_L_HILLS_64) / sizeof(int); i >= 0; i--)
+        for (i = sizeof(BIOMES_L_HILLS_64) / sizeof(int) - 1; i >= 0; i--)
             if (BIOMES_L_HILLS_64[i] == id)
                 break;
         if (i < 0) break;
@@ -2851,7 +2933,7 @@ void genPotential(uint64_t *mL, uint64_t *mM, int layer, int mc, int id)
         break;
 
     case L_RARE_BIOME_64: // biomes added in (L_RARE_BIOME_64, L_SHORE_16]
-        for (i = sizeof(BIOMES_L_HILLS_64) / sizeof(int); i >= 0; i--)
+        for (i = sizeof(BIOMES_L_HILLS_64) / sizeof(int) - 1; i >= 0; i--)
             if (BIOMES_L_HILLS_64[i] == id)
                 break;
         if (i < 0 && id != sunflower_plains) break;
@@ -2873,7 +2955,7 @@ void genPotential(uint64_t *mL, uint64_t *mM, int layer, int mc, int id)
         break;
 
     case L_SHORE_16: // biomes added in (L_SHORE_16, L_RIVER_MIX_4]
-        for (i = sizeof(BIOMES_L_SHORE_16) / sizeof(int); i >= 0; i--)
+        for (i = sizeof(BIOMES_L_SHORE_16) / sizeof(int) - 1; i >= 0; i--)
             if (BIOMES_L_SHORE_16[i] == id)
                 break;
         if (i < 0) break;
@@ -2897,6 +2979,10 @@ void genPotential(uint64_t *mL, uint64_t *mM, int layer, int mc, int id)
             }
             else if (id == deep_ocean)
             {
+                // warm temperatures and those next to land are shallow
+                genPotential(mL, mM, L_VORONOI_ZOOM_1, mc, warm_ocean);
+                genPotential(mL, mM, L_VORONOI_ZOOM_1, mc, lukewarm_ocean);
+                genPotential(mL, mM, L_VORONOI_ZOOM_1, mc, cold_ocean);
                 genPotential(mL, mM, L_VORONOI_ZOOM_1, mc, deep_ocean);
                 genPotential(mL, mM, L_VORONOI_ZOOM_1, mc, deep_lukewarm_ocean);
                 genPotential(mL, mM, L_VORONOI_ZOOM_1, mc, deep_cold_ocean);
@@ -481,9 +481,16 @@ int scanForQuads(
 
 /* Returns the biome for the specified block position.
  * (Alternatives should be considered first in performance critical code.)
+ * This uses about 54 KB of stack (see genPoint()).
  */
 int getBiomeAtPos(const LayerStack *g, const Pos pos);
 
+/* Gets the biomes for 'n' block positions and stores them in 'out'. This is
+ * more efficient than individual calls to getBiomeAtPos() when the positions
+ * are near each other. Returns non-zero if the generation failed.
+ */
+int getBiomesAtPositions(const LayerStack *g, const Pos *pos, int n, int *out);
+
 /* Get the shadow seed.
  */
 static inline int64_t getShadow(int64_t seed)
@@ -645,6 +652,8 @@ Pos estimateSpawn(const int mcversion, const LayerStack *g, int *cache, int64_t
  * @structureType  : structure type to be checked
  * @mc             : minecraft version
  * @g              : generator layer stack, seed will be applied to layers
+ *                   (use the stack of a LayerContext to share a generator
+ *                   between threads)
  * @seed           : world seed, will be applied to generator
  * @blockX, blockZ : block coordinates
  *
@@ -710,8 +719,12 @@ BiomeFilter setupBiomeFilter(const int *biomeList, int listLen);
  * Otherwise, the contents of 'cache' is undefined and a value <= 0 is returned.
  * More aggressive filtering can be enabled with 'protoCheck' which may yield
  * some false negatives in exchange for speed.
+ * From L_BIOME_256 on, the area of each checked layer also has to hold biomes
+ * that the required ones can descend from (see genPotential()), so an area is
+ * rejected before the finer layers are generated once they cannot appear.
  *
- * @g           : generator (will be modified!)
+ * @g           : generator (will be modified! use the stack of a LayerContext
+ *                to share a generator between threads)
  * @layerID     : layer enum of generation entry point
  * @cache       : working buffer, and output (if != NULL)
  * @seed        : world seed
@@ -4,6 +4,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 
 
@@ -19,6 +26,9 @@ void setupLayer(Layer *l, Layer *p, int s, mapfunc_t getMap)
     l->getMap = getMap;
     l->noise = NULL;
     l->data = NULL;
+    l->worldSeed = 0;
+    l->noiseState = LAYER_NOISE_NONE;
+    l->id = -1;
 }
 
 void setupMultiLayer(Layer *l, Layer *p1, Layer *p2, int s, mapfunc_t getMap)
@@ -45,6 +55,11 @@ static void setupScale(Layer *l, int scale)
         m = 4;
         e = 7;
     }
+    else if (map == mapApproxZoom4 || map == mapApproxZoom16)
+    {
+        m = map == mapApproxZoom4 ? 4 : 16;
+        e = 2;
+    }
     else if (map == mapOceanMix)
     {
         e = 17;
@@ -190,6 +205,10 @@ static void setupGeneratorImpl(LayerStack *g, int mcversion, int largeBiomes)
 
     setupScale(&l[L_VORONOI_ZOOM_1], 1);
     g->entry_1 = &l[L_VORONOI_ZOOM_1];
+
+    int i;
+    for (i = 0; i < L_NUM; i++)
+        l[i].id = i;
 }
 
 void setupGenerator(LayerStack *g, int mcversion)
@@ -202,42 +221,299 @@ void setupLargeBiomesGenerator(LayerStack *g, int mcversion)
     setupGeneratorImpl(g, mcversion, 1);
 }
 
+void setupApproxGenerator(LayerStack *g, int mcversion, int approx)
+{
+    setupGeneratorImpl(g, mcversion, 0);
+    Layer *l = g->layers;
+
+    if (approx == APPROX_SCALE_64)
+    {
+        // the 1:4 scale is stretched from the hills
+        setupLayer(g->entry_4, &l[L_HILLS_64], 0, mapApproxZoom16);
+    }
+    else
+    {
+        // the shores and both smoothing layers are left out
+        l[L_ZOOM_8].p = &l[L_ZOOM_16];
+        l[L_RIVER_MIX_4].p = &l[L_ZOOM_4];
+        l[L_RIVER_MIX_4].p2 = &l[L_RIVER_4];
+    }
+    setupLayer(&l[L_VORONOI_ZOOM_1], g->entry_4, 0, mapApproxZoom4);
+
+    setupScale(&l[L_VORONOI_ZOOM_1], 1);
+
+    int i;
+    for (i = 0; i < L_NUM; i++)
+        l[i].id = i;
+}
+
+
+/* Magnification of a layer relative to its parent. */
+static int getZoom(const Layer *layer)
+{
+    if (layer->getMap == mapZoom || layer->getMap == mapZoomIsland)
+        return 2;
+    if (layer->getMap == mapVoronoiZoom || layer->getMap == mapVoronoiZoom114)
+        return 4;
+    if (layer->getMap == mapApproxZoom4)
+        return 4;
+    if (layer->getMap == mapApproxZoom16)
+        return 16;
+    return 1;
+}
 
-/* Recursively calculates the minimum buffer size required to generate an area
- * of the specified size from the current layer onwards.
+/* The planner follows the buffer layout of the layer functions: each layer
+ * has its parent generate into the start of its output, or after its output
+ * or the area of the first parent (see the layer functions in layers.c), and
+ * uses the space after the parent area as scratch. The planned areas are the
+ * exact ones for a given position. The size that holds for any position uses
+ * the largest area of each layer over the alignments of the position instead,
+ * and also covers the layout of the zooms one layer at a time, which the lanes
+ * of multiseed use, besides that of the zoom chains.
+ * The engines of the point queries generate each layer from stand-ins of its
+ * parents, which only provide their area. Their plans stop at the parents of
+ * the 'shallow' layer.
  */
-static void getMaxArea(const Layer *layer, int areaX, int areaZ, int *maxX, int *maxZ)
+STRUCT(PlanCtx)
 {
-    if (layer == NULL)
-        return;
+    LayerPlan *plan;    // steps are recorded if not NULL
+    int cap;
+    int err;
+    int anyPos;
+    const Layer *shallow;
+};
 
-    if (layer->getMap == mapZoom || layer->getMap == mapZoomIsland)
+static int mapTileCache(const Layer *l, int *out, int x, int z, int w, int h);
+
+static inline size_t maxSize(size_t a, size_t b)
+{
+    return a > b ? a : b;
+}
+
+/* Area of the parent of a zoom by 'zoom' (2 or 4), whose area is offset by
+ * 'off' cells.
+ */
+static inline void planZoomDim(const PlanCtx *c, int zoom, int off,
+        int x, int w, int *px, int *pw)
+{
+    int s = zoom == 2 ? 1 : 2;
+    int e = zoom == 2 ? 1 : 2;
+    x -= off;
+    *px = x >> s;
+    if (c->anyPos)
+        *pw = ((w + zoom - 1) >> s) + e;
+    else
+        *pw = ((x + w) >> s) - *px + e;
+}
+
+/* Plans the generation of an area of a layer, whose output starts at 'at' in
+ * the buffer, and returns the end of the buffer space it uses.
+ */
+static size_t planLayer(PlanCtx *c, const Layer *l,
+        int x, int z, int w, int h, size_t at)
+{
+    mapfunc_t map = l->getMap;
+    size_t end = at + (size_t)w * h;
+    int pX, pZ, pW, pH;
+    int step = -1;
+
+    if (c->shallow && c->shallow != l)
+        return end;
+
+    if (c->plan)
+    {
+        LayerPlan *plan = c->plan;
+        if (plan->n == c->cap)
+        {
+            int cap = c->cap ? 2 * c->cap : 64;
+            LayerPlanStep *steps = (LayerPlanStep *)
+                    realloc(plan->steps, cap * sizeof(LayerPlanStep));
+            if (steps == NULL)
+            {
+                c->err = 1;
+                return end;
+            }
+            plan->steps = steps;
+            c->cap = cap;
+        }
+        step = plan->n++;
+        LayerPlanStep *st = &plan->steps[step];
+        st->layer = l;
+        st->x = x; st->z = z; st->w = w; st->h = h;
+        st->offset = at;
+    }
+
+    if (map == mapZoom && l->p->getMap == mapZoom && !c->shallow)
+    {
+        // chain: output, area of the first parent (+1) and the rings
+        const Layer *p = l;
+        size_t rings = 0;
+        int n = 0;
+        pX = x; pZ = z; pW = w; pH = h;
+        do
+        {
+            planZoomDim(c, 2, 0, pX, pW, &pX, &pW);
+            planZoomDim(c, 2, 0, pZ, pH, &pZ, &pH);
+            rings += 4 * ((size_t)pW << 1);
+            p = p->p;
+        }
+        while (++n < ZOOM_CHAIN_MAX && p->getMap == mapZoom);
+
+        size_t base = at + (size_t)w * h;
+        end = maxSize(end, planLayer(c, p, pX, pZ, pW, pH, base));
+        end = maxSize(end, base + (size_t)pW * pH + 1 + rings);
+
+        if (!c->anyPos)
+            goto done;
+    }
+
+    if (map == mapZoom || map == mapZoomIsland)
+    {
+        planZoomDim(c, 2, 0, x, w, &pX, &pW);
+        planZoomDim(c, 2, 0, z, h, &pZ, &pH);
+        end = maxSize(end, planLayer(c, l->p, pX, pZ, pW, pH, at));
+        end = maxSize(end, at + 5 * (size_t)pW * pH);
+    }
+    else if (map == mapVoronoiZoom || map == mapVoronoiZoom114)
+    {
+        planZoomDim(c, 4, 2, x, w, &pX, &pW);
+        planZoomDim(c, 4, 2, z, h, &pZ, &pH);
+        if (l->p)
+            end = maxSize(end, planLayer(c, l->p, pX, pZ, pW, pH, at));
+        if (map == mapVoronoiZoom)
+            end = maxSize(end, at + (size_t)pW * pH + (size_t)w * h);
+        else
+            end = maxSize(end, at + (size_t)pW * pH + 16 * (size_t)pW * (pH-1));
+    }
+    else if (map == mapApproxZoom4 || map == mapApproxZoom16)
+    {
+        int s = map == mapApproxZoom4 ? 2 : 4;
+        pX = x >> s;
+        pZ = z >> s;
+        if (c->anyPos)
+        {
+            pW = ((w - 1) >> s) + 2;
+            pH = ((h - 1) >> s) + 2;
+        }
+        else
+        {
+            pW = ((x + w - 1) >> s) - pX + 1;
+            pH = ((z + h - 1) >> s) - pZ + 1;
+        }
+        end = maxSize(end, planLayer(c, l->p, pX, pZ, pW, pH,
+                at + (size_t)w * h));
+    }
+    else if (map == mapOceanMix)
+    {
+        // the land area depends on the ocean temperatures, and is at most
+        // 8 cells larger on the top and left, and 9 on the bottom and right
+        end = maxSize(end, planLayer(c, l->p2, x, z, w, h, at));
+        end = maxSize(end, planLayer(c, l->p, x-8, z-8, w+17, h+17,
+                at + (size_t)w * h));
+    }
+    else if (map == mapRiverMix)
+    {
+        end = maxSize(end, planLayer(c, l->p, x, z, w, h, at));
+        end = maxSize(end, planLayer(c, l->p2, x, z, w, h, at + (size_t)w * h));
+    }
+    else if (map == mapHills || map == mapHills112)
+    {
+        end = maxSize(end, planLayer(c, l->p, x-1, z-1, w+2, h+2, at));
+        end = maxSize(end, planLayer(c, l->p2, x-1, z-1, w+2, h+2,
+                at + (size_t)(w+2) * (h+2)));
+    }
+    else if (
+        map == mapAddIsland ||
+        map == mapRemoveTooMuchOcean ||
+        map == mapAddSnow ||
+        map == mapCoolWarm ||
+        map == mapHeatIce ||
+        map == mapAddMushroomIsland ||
+        map == mapDeepOcean ||
+        map == mapBiomeEdge ||
+        map == mapRiver ||
+        map == mapSmooth ||
+        map == mapShore ||
+        map == mapSpecial ||
+        map == mapBiome ||
+        map == mapBiomeBE ||
+        map == mapRiverInit ||
+        map == mapAddBamboo ||
+        map == mapRareBiome
+        )
     {
-        areaX >>= 1;
-        areaZ >>= 1;
+        // generated in place from the parent, with its edge
+        int e = l->edge;
+        end = maxSize(end, planLayer(c, l->p, x - (e >> 1), z - (e >> 1),
+                w + e, h + e, at));
     }
-    else if (layer->getMap == mapVoronoiZoom)
+    else if (map == mapIsland || map == mapOceanTemp || map == mapTileCache)
     {
-        areaX >>= 2;
-        areaZ >>= 2;
+        // only the output
     }
+    else
+    {
+        // the custom layers are assumed to read their parents with the edge,
+        // the second one after the area of the first
+        int e = l->edge;
+        pX = x - (e >> 1);
+        pZ = z - (e >> 1);
+        pW = w + e;
+        pH = h + e;
+        if (l->p)
+            end = maxSize(end, planLayer(c, l->p, pX, pZ, pW, pH, at));
+        if (l->p2)
+            end = maxSize(end, planLayer(c, l->p2, pX, pZ, pW, pH,
+                    at + (size_t)pW * pH));
+    }
+
+done:
+    if (step >= 0)
+        c->plan->steps[step].size = end - at;
+    return end;
+}
+
+static size_t getRequiredBuf(const Layer *layer, int areaX, int areaZ)
+{
+    PlanCtx c = { NULL, 0, 0, 1, NULL };
+    return planLayer(&c, layer, 0, 0, areaX, areaZ, 0);
+}
 
-    areaX += layer->edge;
-    areaZ += layer->edge;
+/* Buffer size to generate an area of a layer at any position, when its
+ * parents only provide their areas.
+ */
+static size_t getShallowBuf(const Layer *layer, int areaX, int areaZ)
+{
+    PlanCtx c = { NULL, 0, 0, 1, layer };
+    return planLayer(&c, layer, 0, 0, areaX, areaZ, 0);
+}
 
-    if (areaX > *maxX) *maxX = areaX;
-    if (areaZ > *maxZ) *maxZ = areaZ;
+int planArea(LayerPlan *plan, const Layer *layer,
+        int areaX, int areaZ, int areaWidth, int areaHeight)
+{
+    PlanCtx c = { plan, 0, 0, 0, NULL };
+    plan->steps = NULL;
+    plan->n = 0;
+    plan->size = planLayer(&c, layer, areaX, areaZ, areaWidth, areaHeight, 0);
+    if (c.err)
+    {
+        freeLayerPlan(plan);
+        return -1;
+    }
+    return 0;
+}
 
-    getMaxArea(layer->p, areaX, areaZ, maxX, maxZ);
-    getMaxArea(layer->p2, areaX, areaZ, maxX, maxZ);
+void freeLayerPlan(LayerPlan *plan)
+{
+    free(plan->steps);
+    plan->steps = NULL;
+    plan->n = 0;
+    plan->size = 0;
 }
 
 int calcRequiredBuf(const Layer *layer, int areaX, int areaZ)
 {
-    int maxX = areaX, maxZ = areaZ;
-    getMaxArea(layer, areaX, areaZ, &maxX, &maxZ);
-
-    return maxX * maxZ;
+    return (int) getRequiredBuf(layer, areaX, areaZ);
 }
 
 int *allocCache(const Layer *layer, int sizeX, int sizeZ)
@@ -245,25 +521,2121 @@ int *allocCache(const Layer *layer, int sizeX, int sizeZ)
     int size = calcRequiredBuf(layer, sizeX, sizeZ);
 
     int *ret = (int *) malloc(sizeof(*ret)*size);
-    memset(ret, 0, sizeof(*ret)*size);
+    if (ret)
+        memset(ret, 0, sizeof(*ret)*size);
 
     return ret;
 }
 
 
+void initWorkspace(LayerWorkspace *ws)
+{
+    ws->buf = NULL;
+    ws->size = 0;
+}
+
+void freeWorkspace(LayerWorkspace *ws)
+{
+    free(ws->buf);
+    initWorkspace(ws);
+}
+
+static int growWorkspace(LayerWorkspace *ws, size_t size)
+{
+    if (size <= ws->size)
+        return 0;
+
+    int *buf = (int *) realloc(ws->buf, size * sizeof(*buf));
+    if (buf == NULL)
+        return -1;
+
+    ws->buf = buf;
+    ws->size = size;
+    return 0;
+}
+
+int reserveWorkspace(LayerWorkspace *ws, const Layer *layer, int sizeX, int sizeZ)
+{
+    return growWorkspace(ws, getRequiredBuf(layer, sizeX, sizeZ));
+}
+
 void applySeed(LayerStack *g, int64_t seed)
 {
     // the seed has to be applied recursively
     setLayerSeed(g->entry_1, seed);
 }
 
+/* Maps a layer of 'src' onto the corresponding layer of 'dst'. References to
+ * layers outside of the generator are kept.
+ */
+static Layer *relinkLayer(const Layer *l, const LayerStack *src, LayerStack *dst)
+{
+    if (l >= src->layers && l < src->layers + L_NUM)
+        return dst->layers + (l - src->layers);
+    return (Layer *) l;
+}
+
+void initLayerContext(LayerContext *ctx, const LayerStack *config)
+{
+    LayerStack *g = &ctx->stack;
+    int i;
+
+    ctx->config = config;
+    memcpy(g->layers, config->layers, sizeof(g->layers));
+
+    for (i = 0; i < L_NUM; i++)
+    {
+        Layer *l = &g->layers[i];
+        if (l->p)
+            l->p = relinkLayer(l->p, config, g);
+        if (l->p2)
+            l->p2 = relinkLayer(l->p2, config, g);
+        if (l->noise == &config->oceanRnd)
+            l->noise = &g->oceanRnd;
+        l->noiseState = LAYER_NOISE_NONE; // the noise of the context
+    }
+
+    g->entry_1 = config->entry_1 ? relinkLayer(config->entry_1, config, g) : NULL;
+    g->entry_4 = config->entry_4 ? relinkLayer(config->entry_4, config, g) : NULL;
+}
+
+void applyContextSeed(LayerContext *ctx, int64_t seed)
+{
+    applySeed(&ctx->stack, seed);
+}
+
 int genArea(const Layer *layer, int *out, int areaX, int areaZ, int areaWidth, int areaHeight)
 {
     memset(out, 0, areaWidth*areaHeight*sizeof(*out));
-    return layer->getMap(layer, out, areaX, areaZ, areaWidth, areaHeight);
+    return getLayerMap(layer, out, areaX, areaZ, areaWidth, areaHeight);
+}
+
+#ifdef DEBUG
+#define PLAN_GUARD 64
+#define PLAN_CANARY 0x5eed5eed
+#endif
+
+int genAreaWs(const Layer *layer, LayerWorkspace *ws, int areaX, int areaZ, int areaWidth, int areaHeight)
+{
+    // the workspace only has to hold the plan for this position
+    PlanCtx c = { NULL, 0, 0, 0, NULL };
+    size_t size = planLayer(&c, layer, areaX, areaZ, areaWidth, areaHeight, 0);
+#ifdef DEBUG
+    size_t i;
+    if U(growWorkspace(ws, size + PLAN_GUARD) != 0)
+        return -1;
+    for (i = 0; i < PLAN_GUARD; i++)
+        ws->buf[size + i] = PLAN_CANARY;
+    int err = getLayerMap(layer, ws->buf, areaX, areaZ, areaWidth, areaHeight);
+    for (i = 0; i < PLAN_GUARD; i++)
+    {
+        if (ws->buf[size + i] != PLAN_CANARY)
+        {
+            fprintf(stderr, "genAreaWs(): Layer generation exceeded its "
+                    "planned buffer of %zu ints.\n", size);
+            exit(1);
+        }
+    }
+    return err;
+#else
+    if U(growWorkspace(ws, size) != 0)
+        return -1;
+    return getLayerMap(layer, ws->buf, areaX, areaZ, areaWidth, areaHeight);
+#endif
 }
 
 
+//==============================================================================
+// Parallel Generation
+//==============================================================================
 
+/* The tiles of a parallel area are independent generations: each layer asks
+ * its parent for the area it needs, including the border given by its edge,
+ * so the overlap between neighbouring tiles is regenerated by each of them
+ * and the result is the same as for the area as a whole.
+ */
+
+STRUCT(TileJob)
+{
+    const Layer *layer;
+    int *out;
+    int x, z, w, h;     // whole area
+    int tileSize;
+    int first, step;    // tiles of this worker
+    int err;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI genTilesThread(LPVOID data)
+#else
+static void *genTilesThread(void *data)
+#endif
+{
+    TileJob *job = (TileJob *) data;
+    int ts = job->tileSize;
+    int tx = (job->w + ts - 1) / ts;
+    int tz = (job->h + ts - 1) / ts;
+    int tw = job->w < ts ? job->w : ts;
+    int th = job->h < ts ? job->h : ts;
+    int *buf = (int *) malloc(getRequiredBuf(job->layer, tw, th) * sizeof(*buf));
+    int t, j;
+
+    job->err = buf == NULL ? -1 : 0;
+
+    for (t = job->first; t < tx*tz && job->err == 0; t += job->step)
+    {
+        int i0 = (t % tx) * ts;
+        int j0 = (t / tx) * ts;
+        tw = job->w - i0 < ts ? job->w - i0 : ts;
+        th = job->h - j0 < ts ? job->h - j0 : ts;
+
+        job->err = getLayerMap(job->layer, buf,
+                job->x + i0, job->z + j0, tw, th);
+
+        for (j = 0; j < th && job->err == 0; j++)
+        {
+            memcpy(&job->out[(size_t)(j0 + j) * job->w + i0], &buf[j * tw],
+                    tw * sizeof(*buf));
+        }
+    }
+
+    free(buf);
+    return 0;
+}
+
+/* Checks whether a layer or one of its ancestors is served by a TileCache. */
+static int hasTileCache(const Layer *layer)
+{
+    if (layer->getMap == mapTileCache)
+        return 1;
+    if (layer->p && hasTileCache(layer->p))
+        return 1;
+    return layer->p2 && hasTileCache(layer->p2);
+}
+
+int genAreaParallel(const Layer *layer, int *out, int areaX, int areaZ,
+        int areaWidth, int areaHeight, int tileSize, int threads)
+{
+    if (tileSize <= 0)
+        tileSize = PARALLEL_TILE_SIZE;
+    // the tiles and the LRU list of a cache are not synchronised
+    if (threads < 1 || hasTileCache(layer))
+        threads = 1;
+
+    int tx = (areaWidth + tileSize - 1) / tileSize;
+    int tz = (areaHeight + tileSize - 1) / tileSize;
+    if (threads > tx * tz)
+        threads = tx * tz;
+    if (threads < 1)
+        return 0;
+
+    TileJob *jobs = (TileJob *) malloc(threads * sizeof(*jobs));
+    int t, err = 0;
+
+    if (jobs == NULL)
+        return -1;
+
+    // the tiles are interleaved among the workers, which balances the
+    // uneven costs of different terrain without any synchronisation
+    for (t = 0; t < threads; t++)
+    {
+        jobs[t].layer = layer;
+        jobs[t].out = out;
+        jobs[t].x = areaX;
+        jobs[t].z = areaZ;
+        jobs[t].w = areaWidth;
+        jobs[t].h = areaHeight;
+        jobs[t].tileSize = tileSize;
+        jobs[t].first = t;
+        jobs[t].step = threads;
+        jobs[t].err = 0;
+    }
+
+#ifdef _WIN32
+    HANDLE *tids = (HANDLE *) malloc(threads * sizeof(*tids));
+#else
+    pthread_t *tids = (pthread_t *) malloc(threads * sizeof(*tids));
+#endif
+
+    // the calling thread runs the first job itself, and also those of any
+    // worker that cannot be started, so every tile is always generated
+    int *started = (int *) calloc(threads, sizeof(*started));
+    int workers = tids != NULL && started != NULL ? threads : 1;
+
+    for (t = 1; t < workers; t++)
+    {
+#ifdef _WIN32
+        tids[t] = CreateThread(NULL, 0, genTilesThread, &jobs[t], 0, NULL);
+        started[t] = tids[t] != NULL;
+#else
+        started[t] = pthread_create(&tids[t], NULL, genTilesThread, &jobs[t]) == 0;
+#endif
+    }
+
+    for (t = 0; t < threads; t++)
+    {
+        if (started && started[t])
+            continue;
+        genTilesThread(&jobs[t]);
+    }
+
+    for (t = 1; t < workers; t++)
+    {
+        if (!started[t])
+            continue;
+#ifdef _WIN32
+        WaitForSingleObject(tids[t], INFINITE);
+        CloseHandle(tids[t]);
+#else
+        pthread_join(tids[t], NULL);
+#endif
+    }
+    free(started);
+    free(tids);
+
+    for (t = 0; t < threads; t++)
+    {
+        if (jobs[t].err != 0)
+            err = jobs[t].err;
+    }
+
+    free(jobs);
+    return err;
+}
+
+
+//==============================================================================
+// Point Queries
+//==============================================================================
+
+/* Point queries evaluate the layer graph lazily. Every layer that the target
+ * depends on gets a window of memoized cells, which covers all the cells that
+ * may be requested from it. The layers are then run on copies whose parents
+ * are replaced by memoizing stand-ins: a request to a parent only generates
+ * the cells that have not been generated before, so each cell of a shared
+ * ancestor is evaluated at most once and only the cells within the footprint
+ * of the actual requests are generated at all. The copies are made on the
+ * stack of the generation that needs them, so the nodes only refer to the
+ * original layers.
+ * A layer gets one node for each scale at which its descendants read it. The
+ * scales differ where a branch has more zooms than another, as the hills and
+ * the rivers of large biomes do. The cells these read from a shared ancestor
+ * then drift apart with the distance from the origin, and a single window
+ * would have to span the distance in between.
+ */
+
+#define MEMO_MAX_NODES  80
+#define MEMO_ARENA      8192    // arena of a point on the stack, in ints
+#define MEMO_NONE       ((int)0x80808080) // not yet generated (memset 0x80)
+// A window that is larger than this many times the cells that are requested
+// from it, plus a slack, is not kept: its layer generates them the usual way.
+#define MEMO_SPREAD     4
+#define MEMO_SLACK      1024
+
+struct MemoEngine;
+
+STRUCT(MemoNode)
+{
+    const Layer *layer;     // original layer
+    int key;                // scale at which the layer is read, in blocks
+    int ip, ip2;            // nodes of the parents, or -1
+    Layer proxy;            // memoizing stand-in that is seen by the children
+    struct MemoEngine *e;
+    int x, z, w, h;         // window of cells that may be requested
+    size_t req;             // cells requested from the window
+    int *win;
+    int r0, r1, cap;        // rows held in a streaming window (see mapStream)
+};
+
+STRUCT(MemoEngine)
+{
+    MemoNode nodes[MEMO_MAX_NODES];
+    int n;
+    size_t len;             // planned windows and scratch, in ints
+    int filled;             // the windows are generated in advance
+    int *top, *end;         // scratch stack for the layer generation
+    int *heap;
+};
+
+static int mapMemo(const Layer *l, int *out, int x, int z, int w, int h);
+static int mapMemoWindow(const Layer *l, int *out, int x, int z, int w, int h);
+
+/* Generates an area the usual way, for requests the windows do not cover. */
+static int genFallback(const Layer *layer, int *out, int x, int z, int w, int h)
+{
+    int *buf = (int *) malloc(getRequiredBuf(layer, w, h) * sizeof(*buf));
+    if U(buf == NULL)
+        return -1;
+    int err = getLayerMap(layer, buf, x, z, w, h);
+    if (err == 0)
+        memcpy(out, buf, w*h*sizeof(*out));
+    free(buf);
+    return err;
+}
+
+/* Scale of a layer that the engine is asked for, as the key of its node. */
+static int getMemoKey(const Layer *l)
+{
+    return l->scale > 0 ? l->scale : 1;
+}
+
+/* Adds a layer that is read at the scale 'key', and its ancestors, to the
+ * engine, parents before children.
+ * Returns the node index or -1 if the graph is too large.
+ */
+static int addMemoNode(MemoEngine *e, const Layer *l, int key, mapfunc_t proxyMap)
+{
+    int i, ip = -1, ip2 = -1;
+    int pkey = key * getZoom(l);
+
+    for (i = 0; i < e->n; i++)
+        if (e->nodes[i].layer == l && e->nodes[i].key == key)
+            return i;
+
+    if (l->p && (ip = addMemoNode(e, l->p, pkey, proxyMap)) < 0)
+        return -1;
+    if (l->p2 && (ip2 = addMemoNode(e, l->p2, pkey, proxyMap)) < 0)
+        return -1;
+    if (e->n >= MEMO_MAX_NODES)
+        return -1;
+
+    MemoNode *nd = &e->nodes[e->n];
+    nd->layer = l;
+    nd->key = key;
+    ensureLayerNoise(l); // once for the original, rather than for every copy
+    nd->ip = ip;
+    nd->ip2 = ip2;
+    memset(&nd->proxy, 0, sizeof(nd->proxy));
+    nd->proxy.getMap = proxyMap;
+    nd->proxy.data = nd;
+    nd->proxy.id = l->id;
+    nd->e = e;
+    nd->x = nd->z = nd->w = nd->h = 0;
+    nd->req = 0;
+    nd->win = NULL;
+    return e->n++;
+}
 
+/* Makes a copy of the layer of a node that requests from the proxies of the
+ * parent nodes.
+ */
+static void copyMemoLayer(MemoEngine *e, const MemoNode *nd, Layer *l)
+{
+    *l = *nd->layer;
+    l->p = nd->ip >= 0 ? &e->nodes[nd->ip].proxy : NULL;
+    l->p2 = nd->ip2 >= 0 ? &e->nodes[nd->ip2].proxy : NULL;
+}
+
+static void addMemoRect(MemoNode *nd, int x, int z, int w, int h)
+{
+    nd->req += (size_t)w * h;
+    if (nd->w == 0)
+    {
+        nd->x = x; nd->z = z; nd->w = w; nd->h = h;
+        return;
+    }
+    int x1 = nd->x + nd->w, z1 = nd->z + nd->h;
+    if (x + w > x1) x1 = x + w;
+    if (z + h > z1) z1 = z + h;
+    if (x < nd->x) nd->x = x;
+    if (z < nd->z) nd->z = z;
+    nd->w = x1 - nd->x;
+    nd->h = z1 - nd->z;
+}
+
+/* Gets the largest area a layer can request from its first or second parent
+ * when generating the given area.
+ */
+static void getParentRect(const Layer *l, int second,
+        int x, int z, int w, int h, int *px, int *pz, int *pw, int *ph)
+{
+    int zoom = getZoom(l);
+    if (l->getMap == mapApproxZoom4 || l->getMap == mapApproxZoom16)
+    {
+        int s = zoom == 4 ? 2 : 4;
+        *px = x >> s;
+        *pz = z >> s;
+        *pw = ((x + w - 1) >> s) - *px + 1;
+        *ph = ((z + h - 1) >> s) - *pz + 1;
+    }
+    else if (zoom == 2)
+    {
+        *px = x >> 1;
+        *pz = z >> 1;
+        *pw = ((x + w) >> 1) - *px + 1;
+        *ph = ((z + h) >> 1) - *pz + 1;
+    }
+    else if (zoom == 4)
+    {
+        x -= 2;
+        z -= 2;
+        *px = x >> 2;
+        *pz = z >> 2;
+        *pw = ((x + w) >> 2) - *px + 2;
+        *ph = ((z + h) >> 2) - *pz + 2;
+    }
+    else if (second && l->getMap == mapOceanMix)
+    {
+        // the ocean temperatures are only needed for the area itself
+        *px = x; *pz = z; *pw = w; *ph = h;
+    }
+    else
+    {
+        *px = x - (l->edge >> 1);
+        *pz = z - (l->edge >> 1);
+        *pw = w + l->edge;
+        *ph = h + l->edge;
+    }
+}
+
+/* Extends the windows of the parents to the cells that their children may
+ * request within their windows. A window that is much larger than the
+ * requests to it is dropped, and its parents get nothing from it.
+ */
+static void spreadMemoRects(MemoEngine *e)
+{
+    int i, k;
+
+    for (i = e->n-1; i >= 0; i--)
+    {
+        MemoNode *nd = &e->nodes[i];
+        int par[2] = { nd->ip, nd->ip2 };
+
+        if U((size_t)nd->w * nd->h > MEMO_SPREAD * nd->req + MEMO_SLACK)
+            nd->w = nd->h = 0;
+        if (nd->w == 0)
+            continue;
+
+        for (k = 0; k < 2; k++)
+        {
+            if (par[k] < 0)
+                continue;
+            int px, pz, pw, ph;
+            getParentRect(nd->layer, k, nd->x, nd->z, nd->w, nd->h,
+                    &px, &pz, &pw, &ph);
+            addMemoRect(&e->nodes[par[k]], px, pz, pw, ph);
+        }
+    }
+}
+
+/* Sets the windows of the nodes to the cells that may be requested when the
+ * last node (the target layer) generates the given area.
+ */
+static void propagateMemoRects(MemoEngine *e, int x, int z, int w, int h)
+{
+    int i;
+
+    for (i = 0; i < e->n; i++)
+    {
+        e->nodes[i].w = 0;
+        e->nodes[i].req = 0;
+    }
+
+    addMemoRect(&e->nodes[e->n-1], x, z, w, h);
+    spreadMemoRects(e);
+}
+
+/* Plans the engine for requests of the given layer within an area: the
+ * windows of the nodes and the scratch space of their generations. Lazy
+ * generations are nested along the paths from the target to its ancestors,
+ * while the windows that are filled in advance (see fillMemoWindows) are
+ * generated one at a time.
+ * Returns non-zero if the layer graph is too large.
+ */
+static int planMemo(MemoEngine *e, const Layer *layer, int x, int z, int w, int h,
+        int filled)
+{
+    size_t peak[MEMO_MAX_NODES];
+    size_t len = 0, top = 0;
+    int i;
+
+    e->n = 0;
+    e->heap = NULL;
+    e->filled = filled;
+    if (addMemoNode(e, layer, getMemoKey(layer),
+            filled ? mapMemoWindow : mapMemo) < 0)
+        return -1;
+
+    // propagate the windows from the children to the parents
+    propagateMemoRects(e, x, z, w, h);
+
+    for (i = 0; i < e->n; i++)
+    {
+        MemoNode *nd = &e->nodes[i];
+        size_t p1 = nd->ip >= 0 ? peak[nd->ip] : 0;
+        size_t p2 = nd->ip2 >= 0 ? peak[nd->ip2] : 0;
+        size_t s = getShallowBuf(nd->layer, nd->w, nd->h);
+        peak[i] = filled ? s : s + (p1 > p2 ? p1 : p2);
+        if (peak[i] > top)
+            top = peak[i];
+        len += (size_t)nd->w * nd->h;
+    }
+    e->len = len + top;
+    return 0;
+}
+
+/* Places the windows of the nodes and the scratch space in the arena, which
+ * is allocated if it is NULL, and marks the cells as missing, unless the
+ * windows are filled in advance.
+ * Returns non-zero if the allocation failed.
+ */
+static int initMemoWindows(MemoEngine *e, int *arena)
+{
+    int i;
+
+    if (arena == NULL)
+    {
+        arena = e->heap = (int *) malloc(e->len * sizeof(int));
+        if (arena == NULL)
+            return -1;
+    }
 
+    e->end = arena + e->len;
+    for (i = 0; i < e->n; i++)
+    {
+        MemoNode *nd = &e->nodes[i];
+        nd->win = arena;
+        arena += nd->w * nd->h;
+    }
+    if (!e->filled)
+        memset(e->nodes[0].win, 0x80, (arena - e->nodes[0].win) * sizeof(int));
+    e->top = arena;
+    return 0;
+}
+
+/* Generates the windows of all the nodes, from the ancestors to the target,
+ * so that the generation of each node finds the cells of its parents ready.
+ */
+static int fillMemoWindows(MemoEngine *e)
+{
+    int i, err;
+
+    for (i = 0; i < e->n; i++)
+    {
+        MemoNode *nd = &e->nodes[i];
+        Layer shadow;
+        if (nd->w == 0)
+            continue;
+        copyMemoLayer(e, nd, &shadow);
+        err = getLayerMap(&shadow, e->top, nd->x, nd->z, nd->w, nd->h);
+        if U(err != 0)
+            return err;
+        memcpy(nd->win, e->top, (size_t)nd->w * nd->h * sizeof(int));
+    }
+    return 0;
+}
+
+static void freeMemo(MemoEngine *e)
+{
+    free(e->heap);
+}
+
+/* Serves the requests to a node from its window, which is generated already,
+ * as the windows of the taps and those filled in advance are.
+ */
+static int mapMemoWindow(const Layer *l, int *out, int x, int z, int w, int h)
+{
+    MemoNode *nd = (MemoNode *) l->data;
+    int j;
+
+    if U(x < nd->x || z < nd->z ||
+         x + w > nd->x + nd->w || z + h > nd->z + nd->h)
+    {
+        return genFallback(nd->layer, out, x, z, w, h);
+    }
+
+    for (j = 0; j < h; j++)
+    {
+        memcpy(&out[j*w], &nd->win[(z - nd->z + j) * nd->w + (x - nd->x)],
+                w*sizeof(int));
+    }
+    return 0;
+}
+
+static int mapMemo(const Layer *l, int *out, int x, int z, int w, int h)
+{
+    MemoNode *nd = (MemoNode *) l->data;
+    MemoEngine *e = nd->e;
+    int i, j, i0, i1, j0, j1, err;
+
+    if U(x < nd->x || z < nd->z ||
+         x + w > nd->x + nd->w || z + h > nd->z + nd->h)
+    {
+        return genFallback(nd->layer, out, x, z, w, h);
+    }
+
+    int *win = nd->win + (z - nd->z) * nd->w + (x - nd->x);
+
+    // find the bounding box of the cells that are still missing
+    i0 = w; i1 = -1;
+    j0 = h; j1 = -1;
+    for (j = 0; j < h; j++)
+    {
+        for (i = 0; i < w; i++)
+        {
+            if (win[j*nd->w + i] != MEMO_NONE)
+                continue;
+            if (i < i0) i0 = i;
+            if (i > i1) i1 = i;
+            if (j < j0) j0 = j;
+            j1 = j;
+        }
+    }
+
+    if (i1 >= 0)
+    {
+        int bw = i1 - i0 + 1;
+        int bh = j1 - j0 + 1;
+        size_t len = getShallowBuf(nd->layer, bw, bh);
+        int *buf = e->top;
+
+        if U(buf + len > e->end)
+            return genFallback(nd->layer, out, x, z, w, h);
+
+        Layer shadow;
+        copyMemoLayer(e, nd, &shadow);
+        e->top += len;
+        err = getLayerMap(&shadow, buf, x + i0, z + j0, bw, bh);
+        e->top = buf;
+        if U(err != 0)
+            return err;
+
+        for (j = 0; j < bh; j++)
+            memcpy(&win[(j0+j)*nd->w + i0], &buf[j*bw], bw*sizeof(int));
+    }
+
+    for (j = 0; j < h; j++)
+        memcpy(&out[j*w], &win[j*nd->w], w*sizeof(int));
+
+    return 0;
+}
+
+
+#define MEMO_SPAN_BITS  5
+#define MEMO_SPAN       (1 << MEMO_SPAN_BITS) // extent of point clusters
+
+STRUCT(PointRef)
+{
+    int cx, cz; // cluster grid cell
+    int i;
+};
+
+static int cmpPointRef(const void *a, const void *b)
+{
+    const PointRef *pa = (const PointRef *) a, *pb = (const PointRef *) b;
+    if (pa->cz != pb->cz) return pa->cz < pb->cz ? -1 : 1;
+    if (pa->cx != pb->cx) return pa->cx < pb->cx ? -1 : 1;
+    return pa->i - pb->i;
+}
+
+int genPoints(const Layer *layer, int *out, const int *pos, int n)
+{
+    PointRef refbuf[64];
+    PointRef *ref = refbuf;
+    MemoEngine e;
+    int arena[MEMO_ARENA];
+    int i, j, k, err = 0;
+
+    if (n > 64)
+        ref = (PointRef *) malloc(n * sizeof(*ref));
+    if U(ref == NULL)
+        return -1;
+
+    // order the points so that nearby ones follow each other
+    for (i = 0; i < n; i++)
+    {
+        ref[i].cx = pos[2*i+0] >> MEMO_SPAN_BITS;
+        ref[i].cz = pos[2*i+1] >> MEMO_SPAN_BITS;
+        ref[i].i = i;
+    }
+    qsort(ref, n, sizeof(*ref), cmpPointRef);
+
+    for (i = 0; i < n; i = j)
+    {
+        int x0, z0, x1, z1;
+        x0 = x1 = pos[2*ref[i].i+0];
+        z0 = z1 = pos[2*ref[i].i+1];
+
+        // grow the cluster while it stays within the span
+        for (j = i+1; j < n; j++)
+        {
+            int x = pos[2*ref[j].i+0];
+            int z = pos[2*ref[j].i+1];
+            int nx0 = x < x0 ? x : x0, nx1 = x > x1 ? x : x1;
+            int nz0 = z < z0 ? z : z0, nz1 = z > z1 ? z : z1;
+            if (nx1 - nx0 >= MEMO_SPAN || nz1 - nz0 >= MEMO_SPAN)
+                break;
+            x0 = nx0; x1 = nx1;
+            z0 = nz0; z1 = nz1;
+        }
+
+        int memo = planMemo(&e, layer, x0, z0, x1-x0+1, z1-z0+1, 0) == 0;
+        if (memo)
+            memo = initMemoWindows(&e, e.len <= MEMO_ARENA ? arena : NULL) == 0;
+
+        for (k = i; k < j; k++)
+        {
+            int p = ref[k].i;
+            int x = pos[2*p+0], z = pos[2*p+1];
+            int r;
+            if L(memo)
+                r = mapMemo(&e.nodes[e.n-1].proxy, &out[p], x, z, 1, 1);
+            else
+                r = genFallback(layer, &out[p], x, z, 1, 1);
+            if (r != 0 && err == 0)
+                err = r;
+        }
+
+        if (memo)
+            freeMemo(&e);
+    }
+
+    if (ref != refbuf)
+        free(ref);
+    return err;
+}
+
+/* Sets the windows of the nodes to the cells that the taps of one group need,
+ * where 'group' holds the group of each tap.
+ */
+static void spreadTapRects(MemoEngine *e, const LayerTap *taps, const int *idx,
+        const int *group, int n, int g)
+{
+    int i;
+
+    for (i = 0; i < e->n; i++)
+    {
+        e->nodes[i].w = 0;
+        e->nodes[i].req = 0;
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (group[i] == g)
+            addMemoRect(&e->nodes[idx[i]], taps[i].x, taps[i].z,
+                    taps[i].w, taps[i].h);
+    }
+    spreadMemoRects(e);
+}
+
+/* Generates the taps of one group, from the ancestors to the descendants. */
+static int genTapGroup(MemoEngine *e, const LayerTap *taps, const int *idx,
+        const int *group, int n, int g, const char *istap)
+{
+    char owned[MEMO_MAX_NODES] = {0};
+    size_t len = 0;
+    int *buf;
+    int i, j, err = 0;
+
+    spreadTapRects(e, taps, idx, group, n, g);
+
+    for (i = 0; i < e->n; i++)
+    {
+        MemoNode *nd = &e->nodes[i];
+        Layer shadow;
+        if (!istap[i] || nd->w == 0)
+            continue;
+        copyMemoLayer(e, nd, &shadow);
+        size_t s = getRequiredBuf(&shadow, nd->w, nd->h);
+        if (s > len)
+            len = s;
+    }
+    buf = (int *) malloc(len * sizeof(int));
+    if U(buf == NULL)
+        err = -1;
+
+    for (i = 0; i < e->n && err == 0; i++)
+    {
+        MemoNode *nd = &e->nodes[i];
+        Layer shadow;
+        if (!istap[i] || nd->w == 0)
+            continue;
+        copyMemoLayer(e, nd, &shadow);
+        err = getLayerMap(&shadow, buf, nd->x, nd->z, nd->w, nd->h);
+
+        // a window that no other tap extends is the output of its tap
+        for (j = 0; j < n; j++)
+        {
+            const LayerTap *t = &taps[j];
+            if (group[j] == g && idx[j] == i &&
+                t->x == nd->x && t->z == nd->z && t->w == nd->w && t->h == nd->h)
+            {
+                nd->win = t->out;
+                break;
+            }
+        }
+        if (j == n)
+        {
+            nd->win = (int *) malloc((size_t)nd->w * nd->h * sizeof(int));
+            owned[i] = 1;
+        }
+        if U(nd->win == NULL)
+            err = -1;
+        else if (err == 0)
+            memcpy(nd->win, buf, (size_t)nd->w * nd->h * sizeof(int));
+    }
+
+    for (i = 0; i < n && err == 0; i++)
+    {
+        const LayerTap *t = &taps[i];
+        if (group[i] == g && t->out != e->nodes[idx[i]].win)
+            err = mapMemoWindow(&e->nodes[idx[i]].proxy, t->out, t->x, t->z, t->w, t->h);
+    }
+
+    for (i = 0; i < e->n; i++)
+    {
+        if (owned[i])
+            free(e->nodes[i].win);
+        e->nodes[i].win = NULL;
+    }
+    free(buf);
+    return err;
+}
+
+/* Checks whether any of the windows of two taps overlap, given the windows
+ * of each tap on its own in 'rects'.
+ */
+static int overlapTapRects(const int *a, const int *b, int n)
+{
+    int k;
+    for (k = 0; k < n; k++, a += 4, b += 4)
+    {
+        if (a[2] == 0 || b[2] == 0)
+            continue;
+        if (a[0] < b[0] + b[2] && b[0] < a[0] + a[2] &&
+            a[1] < b[1] + b[3] && b[1] < a[1] + a[3])
+            return 1;
+    }
+    return 0;
+}
+
+int genAreaTaps(const LayerTap *taps, int n)
+{
+    MemoEngine *e = (MemoEngine *) malloc(sizeof(MemoEngine));
+    char istap[MEMO_MAX_NODES] = {0};
+    int idx[MEMO_MAX_NODES];
+    int group[MEMO_MAX_NODES];
+    int *rects = NULL;
+    int i, j, k, g, memo = n <= MEMO_MAX_NODES, err = 0;
+
+    if U(e == NULL)
+        return -1;
+
+    e->n = 0;
+    for (i = 0; i < n && memo; i++)
+    {
+        idx[i] = addMemoNode(e, taps[i].layer, getMemoKey(taps[i].layer),
+                mapMemoWindow);
+        memo = idx[i] >= 0;
+    }
+    if (memo)
+    {
+        rects = (int *) malloc((size_t)n * e->n * 4 * sizeof(int));
+        memo = rects != NULL;
+    }
+
+    if (memo)
+    {
+        // The other layers are generated as usual by their children, so
+        // their proxies become plain copies, which keeps the zoom chains.
+        for (i = 0; i < n; i++)
+            istap[idx[i]] = 1;
+        for (i = 0; i < e->n; i++)
+        {
+            if (!istap[i])
+                copyMemoLayer(e, &e->nodes[i], &e->nodes[i].proxy);
+        }
+
+        // The taps are generated in groups whose windows do not overlap with
+        // those of the other groups, so that the windows of distant taps do
+        // not span the distance between them.
+        for (i = 0; i < n; i++)
+            group[i] = i;
+        for (i = 0; i < n; i++)
+        {
+            spreadTapRects(e, taps, idx, group, n, i);
+            for (k = 0; k < e->n; k++)
+            {
+                int *r = &rects[(i * e->n + k) * 4];
+                r[0] = e->nodes[k].x;
+                r[1] = e->nodes[k].z;
+                r[2] = e->nodes[k].w;
+                r[3] = e->nodes[k].h;
+            }
+        }
+        for (i = 0; i < n; i++)
+        {
+            for (j = i+1; j < n; j++)
+            {
+                if (group[j] == group[i] ||
+                    !overlapTapRects(&rects[i * e->n * 4], &rects[j * e->n * 4], e->n))
+                    continue;
+                for (g = group[j], k = 0; k < n; k++)
+                {
+                    if (group[k] == g)
+                        group[k] = group[i];
+                }
+            }
+        }
+
+        for (g = 0; g < n && err == 0; g++)
+        {
+            for (i = 0; i < n && group[i] != g; i++);
+            if (i < n)
+                err = genTapGroup(e, taps, idx, group, n, g, istap);
+        }
+    }
+
+    for (i = 0; i < n && err == 0; i++)
+    {
+        const LayerTap *t = &taps[i];
+        if (!memo)
+            err = genFallback(t->layer, t->out, t->x, t->z, t->w, t->h);
+    }
+
+    free(rects);
+    free(e);
+    return err;
+}
+
+int genPoint(const Layer *layer, int *out, int x, int z)
+{
+    MemoEngine e;
+    int arena[MEMO_ARENA];
+
+    // the windows of a single position are exactly the cells it depends on,
+    // so they are filled in advance, which needs the least scratch space
+    if U(planMemo(&e, layer, x, z, 1, 1, 1) != 0)
+        return genFallback(layer, out, x, z, 1, 1);
+    if U(initMemoWindows(&e, e.len <= MEMO_ARENA ? arena : NULL) != 0)
+        return -1;
+
+    int err = fillMemoWindows(&e);
+    if (err == 0)
+        err = mapMemoWindow(&e.nodes[e.n-1].proxy, out, x, z, 1, 1);
+    freeMemo(&e);
+    return err;
+}
+
+
+//==============================================================================
+// Streaming
+//==============================================================================
+
+/* A streamed area is generated in bands of columns, and each band from top to
+ * bottom in strips of rows. The engine of the point queries is reused: each
+ * ancestor of the target layer gets a window that spans the columns of the
+ * band, but only holds the rows of one strip, as a ring. Going from one strip
+ * to the next, the rows that the new strip still needs (the overlap due to
+ * the edges of the children) are kept, and only the rows below them are
+ * generated. The memory therefore depends on the size of the bands and the
+ * strips, but not on the size of the area. A band for which a window would
+ * be dropped at some layer (see MEMO_SPREAD) is generated in independent
+ * strips instead.
+ */
+
+static inline int ringRow(int r, int cap)
+{
+    r %= cap;
+    return r < 0 ? r + cap : r;
+}
+
+static int mapStream(const Layer *l, int *out, int x, int z, int w, int h)
+{
+    MemoNode *nd = (MemoNode *) l->data;
+    MemoEngine *e = nd->e;
+    int j, err;
+
+    if U(x < nd->x || z < nd->z ||
+         x + w > nd->x + nd->w || z + h > nd->z + nd->h)
+    {
+        return genFallback(nd->layer, out, x, z, w, h);
+    }
+
+    if (z + h > nd->r1)
+    {
+        // generate the missing rows below those held, for the whole window
+        int bh = z + h - nd->r1;
+        size_t len = getShallowBuf(nd->layer, nd->w, bh);
+        int *buf = e->top;
+
+        if U(buf + len > e->end)
+            return genFallback(nd->layer, out, x, z, w, h);
+
+        Layer shadow;
+        copyMemoLayer(e, nd, &shadow);
+        e->top += len;
+        err = getLayerMap(&shadow, buf, nd->x, nd->r1, nd->w, bh);
+        e->top = buf;
+        if U(err != 0)
+            return err;
+
+        for (j = 0; j < bh; j++)
+        {
+            int r = ringRow(nd->r1 + j, nd->cap);
+            memcpy(&nd->win[r * nd->w], &buf[j * nd->w], nd->w*sizeof(int));
+        }
+        nd->r1 = z + h;
+    }
+
+    for (j = 0; j < h; j++)
+    {
+        int r = ringRow(z + j, nd->cap);
+        memcpy(&out[j*w], &nd->win[r * nd->w + (x - nd->x)], w*sizeof(int));
+    }
+
+    return 0;
+}
+
+/* Sizes the rings of the nodes for the strips of a band. The heights of the
+ * windows vary with the alignment of the strips to the zooms, while the
+ * columns stay the same, so the rings are sized for the tallest window of
+ * each layer. Returns non-zero if the window of a node is dropped for one
+ * of the strips, which the rows held by its ring could not follow.
+ */
+static int planStreamBand(MemoEngine *e, int x, int z, int w, int h,
+        int stripHeight)
+{
+    int i, s, sh;
+
+    for (i = 0; i < e->n; i++)
+        e->nodes[i].cap = 0;
+    for (s = 0; s < h; s += stripHeight)
+    {
+        sh = h - s < stripHeight ? h - s : stripHeight;
+        propagateMemoRects(e, x, z + s, w, sh);
+        for (i = 0; i < e->n; i++)
+        {
+            MemoNode *nd = &e->nodes[i];
+            if (nd->req > 0 && nd->w == 0)
+                return 1;
+            if (nd->cap < nd->h)
+                nd->cap = nd->h;
+        }
+    }
+    return 0;
+}
+
+static int streamBand(MemoEngine *e, int *strip, int x, int z, int w, int h,
+        int stripHeight, stripfunc_t callback, void *data)
+{
+    MemoNode *top = &e->nodes[e->n-1];
+    Layer shadow;
+    size_t len, scratch;
+    int i, s, sh, err = 0;
+
+    len = scratch = 0;
+    for (i = 0; i < e->n - 1; i++)
+    {
+        MemoNode *nd = &e->nodes[i];
+        len += (size_t)nd->w * nd->cap;
+        scratch += getShallowBuf(nd->layer, nd->w, nd->cap);
+    }
+
+    int *arena = (int *) malloc((len + scratch + 1) * sizeof(int));
+    int *a = arena;
+    if (arena == NULL)
+        return -1;
+
+    for (i = 0; i < e->n - 1; i++)
+    {
+        MemoNode *nd = &e->nodes[i];
+        nd->win = a;
+        a += (size_t)nd->w * nd->cap;
+        nd->r0 = nd->r1 = INT_MIN;
+    }
+    e->top = a;
+    e->end = a + scratch;
+    copyMemoLayer(e, top, &shadow);
+
+    for (s = 0; s < h && err == 0; s += stripHeight)
+    {
+        sh = h - s < stripHeight ? h - s : stripHeight;
+        propagateMemoRects(e, x, z + s, w, sh);
+
+        // drop the rows that are above the windows of this strip
+        for (i = 0; i < e->n - 1; i++)
+        {
+            MemoNode *nd = &e->nodes[i];
+            if (nd->r0 < nd->z)
+                nd->r0 = nd->z;
+            if (nd->r1 < nd->r0)
+                nd->r1 = nd->r0;
+        }
+
+        err = getLayerMap(&shadow, strip, x, z + s, w, sh);
+        if (err == 0)
+            err = callback(data, strip, x, z + s, w, sh);
+    }
+
+    free(arena);
+    return err;
+}
+
+int genAreaStream(const Layer *layer, int areaX, int areaZ, int areaWidth,
+        int areaHeight, int bandWidth, int stripHeight,
+        stripfunc_t callback, void *data)
+{
+    MemoEngine e;
+    int bx, bw, err = 0;
+
+    if (bandWidth <= 0 || bandWidth > areaWidth)
+        bandWidth = areaWidth;
+    if (stripHeight <= 0)
+        stripHeight = STREAM_STRIP_HEIGHT;
+    if (stripHeight > areaHeight)
+        stripHeight = areaHeight;
+    if (areaWidth <= 0 || areaHeight <= 0)
+        return 0;
+
+    e.n = 0;
+    e.heap = NULL;
+    int memo = addMemoNode(&e, layer, getMemoKey(layer), mapStream) >= 0;
+    size_t len = maxSize(getShallowBuf(layer, bandWidth, stripHeight),
+                         getRequiredBuf(layer, bandWidth, stripHeight));
+    int *strip = (int *) malloc(len * sizeof(int));
+    if (strip == NULL)
+        return -1;
+
+    for (bx = 0; bx < areaWidth && err == 0; bx += bandWidth)
+    {
+        bw = areaWidth - bx < bandWidth ? areaWidth - bx : bandWidth;
+
+        if (memo && planStreamBand(&e, areaX + bx, areaZ, bw, areaHeight,
+                stripHeight) == 0)
+        {
+            err = streamBand(&e, strip, areaX + bx, areaZ, bw, areaHeight,
+                    stripHeight, callback, data);
+            continue;
+        }
+
+        // the layer graph is too large for the engine, or the band is too
+        // far spread at some layer: independent strips
+        int s, sh;
+        for (s = 0; s < areaHeight && err == 0; s += stripHeight)
+        {
+            sh = areaHeight - s < stripHeight ? areaHeight - s : stripHeight;
+            err = getLayerMap(layer, strip, areaX + bx, areaZ + s, bw, sh);
+            if (err == 0)
+                err = callback(data, strip, areaX + bx, areaZ + s, bw, sh);
+        }
+    }
+
+    free(strip);
+    return err;
+}
+
+
+//==============================================================================
+// Packed Output
+//==============================================================================
+
+int getLayerCellBytes(const Layer *layer)
+{
+    mapfunc_t map = layer->getMap;
+
+    // the river noise is kept in full width until it is consumed, and the
+    // river layer marks the cells without a river as -1
+    if (map == mapRiverInit || map == mapRiver)
+        return 4;
+    // the special climates are flagged in the bits 0xf00
+    if (map == mapSpecial)
+        return 2;
+    // these layers produce land/ocean flags, climates or biomeIDs
+    if (map == mapIsland || map == mapOceanTemp ||
+        map == mapBiome || map == mapBiomeBE ||
+        map == mapHills || map == mapHills112 ||
+        map == mapRiverMix || map == mapOceanMix)
+        return 1;
+    // the others only pass on values of their parents
+    if (layer->p == NULL)
+        return 4;
+
+    int n = getLayerCellBytes(layer->p);
+    if (layer->p2)
+    {
+        int n2 = getLayerCellBytes(layer->p2);
+        if (n2 > n)
+            n = n2;
+    }
+    return n;
+}
+
+STRUCT(PackedOut)
+{
+    void *out;
+    int cellBytes;
+    int x, z, w;
+};
+
+static int storePacked(void *data, const int *ids, int x, int z, int w, int h)
+{
+    PackedOut *c = (PackedOut *) data;
+    int i, j;
+
+    for (j = 0; j < h; j++)
+    {
+        const int *src = &ids[j*w];
+        size_t idx = (size_t)(z - c->z + j) * c->w + (x - c->x);
+
+        if (c->cellBytes == 1)
+        {
+            uint8_t *dst = (uint8_t *) c->out + idx;
+            for (i = 0; i < w; i++)
+                dst[i] = (uint8_t) src[i];
+        }
+        else if (c->cellBytes == 2)
+        {
+            uint16_t *dst = (uint16_t *) c->out + idx;
+            for (i = 0; i < w; i++)
+                dst[i] = (uint16_t) src[i];
+        }
+        else
+        {
+            memcpy((int *) c->out + idx, src, w*sizeof(int));
+        }
+    }
+    return 0;
+}
+
+int genAreaPacked(const Layer *layer, void *out, int cellBytes,
+        int areaX, int areaZ, int areaWidth, int areaHeight)
+{
+    if (cellBytes != 1 && cellBytes != 2 && cellBytes != 4)
+        return -1;
+    if (cellBytes < getLayerCellBytes(layer))
+        return -1;
+
+    PackedOut c = { out, cellBytes, areaX, areaZ, areaWidth };
+    int partWidth = areaWidth < PACKED_PART_WIDTH ? areaWidth : PACKED_PART_WIDTH;
+    int partHeight = partWidth > 0 ? PACKED_PART_CELLS / partWidth : 1;
+    if (partHeight > areaHeight)
+        partHeight = areaHeight;
+    if (partHeight < 1)
+        partHeight = 1;
+
+    size_t len = getRequiredBuf(layer, partWidth, partHeight);
+    int *buf = (int *) malloc(len * sizeof(int));
+    int x, z, w, h, err = 0;
+    if U(buf == NULL)
+        return -1;
+
+    for (z = 0; z < areaHeight && err == 0; z += partHeight)
+    {
+        h = areaHeight - z < partHeight ? areaHeight - z : partHeight;
+        for (x = 0; x < areaWidth && err == 0; x += partWidth)
+        {
+            w = areaWidth - x < partWidth ? areaWidth - x : partWidth;
+            err = getLayerMap(layer, buf, areaX + x, areaZ + z, w, h);
+            if (err == 0)
+                storePacked(&c, buf, areaX + x, areaZ + z, w, h);
+        }
+    }
+
+    free(buf);
+    return err;
+}
+
+
+//==============================================================================
+// Tile Cache
+//==============================================================================
+
+STRUCT(TileEntry)
+{
+    TileEntry *prev, *next;     // neighbours in the order of use
+    TileEntry *hnext;           // next entry in the hash bucket
+    TileCacheSlot *slot;
+    int tx, tz;
+    int *tile;
+};
+
+static inline int floorDiv(int a, int b)
+{
+    return a >= 0 ? a / b : -1 - (-1 - a) / b;
+}
+
+static inline TileEntry **getTileBucket(TileCache *tc,
+        const TileCacheSlot *slot, int tx, int tz)
+{
+    uint64_t h = (uint64_t)(slot - tc->slots);
+    h = h * 0x9E3779B97F4A7C15ULL + (uint32_t) tx;
+    h = h * 0x9E3779B97F4A7C15ULL + (uint32_t) tz;
+    h ^= h >> 29;
+    return &tc->buckets[h & (tc->nbuckets - 1)];
+}
+
+static void unlinkTile(TileCache *tc, TileEntry *t)
+{
+    if (t->prev) t->prev->next = t->next; else tc->lru = t->next;
+    if (t->next) t->next->prev = t->prev; else tc->mru = t->prev;
+    t->prev = t->next = NULL;
+}
+
+static void pushTile(TileCache *tc, TileEntry *t)
+{
+    t->prev = tc->mru;
+    t->next = NULL;
+    if (tc->mru) tc->mru->next = t; else tc->lru = t;
+    tc->mru = t;
+}
+
+static void dropTile(TileCache *tc, TileEntry *t)
+{
+    TileEntry **b = getTileBucket(tc, t->slot, t->tx, t->tz);
+    while (*b != t)
+        b = &(*b)->hnext;
+    *b = t->hnext;
+    unlinkTile(tc, t);
+    t->slot = NULL;
+}
+
+/* Drops the tiles of a slot, as they belong to a previous world seed. */
+static void flushTileSlot(TileCache *tc, TileCacheSlot *slot)
+{
+    TileEntry *t, *next;
+    for (t = tc->lru; t; t = next)
+    {
+        next = t->next;
+        if (t->slot == slot)
+        {
+            dropTile(tc, t);
+            t->next = tc->unused;
+            tc->unused = t;
+        }
+    }
+}
+
+/* Returns an entry for a new tile: an unused one while the cap allows it, or
+ * the least recently used one otherwise.
+ */
+static TileEntry *getFreeTile(TileCache *tc)
+{
+    TileEntry *t;
+
+    if (tc->unused)
+    {
+        t = tc->unused;
+        tc->unused = t->next;
+        t->next = NULL;
+        return t;
+    }
+    if (tc->nentries < tc->maxEntries)
+    {
+        t = &tc->entries[tc->nentries];
+        t->tile = (int *) malloc(sizeof(int) * tc->tileSize * tc->tileSize);
+        if (t->tile != NULL)
+        {
+            tc->nentries++;
+            return t;
+        }
+    }
+    if (tc->lru == NULL)
+        return NULL;
+    t = tc->lru;
+    dropTile(tc, t);
+    tc->evictions++;
+    return t;
+}
+
+/* Gets a tile of the cache, which is generated on a miss. Returns NULL with
+ * the return value of the failed generation in 'err' otherwise.
+ */
+static const int *getTile(TileCacheSlot *slot, const Layer *l, int tx, int tz,
+        int *err)
+{
+    TileCache *tc = slot->tc;
+    TileEntry **b = getTileBucket(tc, slot, tx, tz);
+    TileEntry *t;
+    int n = tc->tileSize;
+
+    for (t = *b; t; t = t->hnext)
+    {
+        if (t->slot == slot && t->tx == tx && t->tz == tz)
+        {
+            unlinkTile(tc, t);
+            pushTile(tc, t);
+            tc->hits++;
+            return t->tile;
+        }
+    }
+
+    // generate the tile with the original layer, which keeps the parents of
+    // 'l', so that a proxy of the point queries still works
+    Layer orig = *l;
+    orig.getMap = slot->getMap;
+    orig.data = slot->data;
+    if U((*err = getLayerMap(&orig, slot->buf, tx * n, tz * n, n, n)) != 0)
+        return NULL;
+    tc->misses++;
+
+    if U((t = getFreeTile(tc)) == NULL)
+    {
+        *err = 1;
+        return NULL;
+    }
+    memcpy(t->tile, slot->buf, sizeof(int) * n * n);
+    t->slot = slot;
+    t->tx = tx;
+    t->tz = tz;
+    b = getTileBucket(tc, slot, tx, tz); // not changed by the generation
+    t->hnext = *b;
+    *b = t;
+    pushTile(tc, t);
+    return t->tile;
+}
+
+static int mapTileCache(const Layer *l, int *out, int x, int z, int w, int h)
+{
+    TileCacheSlot *slot = (TileCacheSlot *) l->data;
+    int n = slot->tc->tileSize;
+    int tx, tz, tx0, tz0, tx1, tz1, j;
+
+    ensureLayerNoise(l); // before the copies of getTile()
+    if (!slot->valid || slot->seed != l->worldSeed)
+    {
+        flushTileSlot(slot->tc, slot);
+        slot->seed = l->worldSeed;
+        slot->valid = 1;
+    }
+
+    tx0 = floorDiv(x, n);
+    tz0 = floorDiv(z, n);
+    tx1 = floorDiv(x + w - 1, n);
+    tz1 = floorDiv(z + h - 1, n);
+
+    for (tz = tz0; tz <= tz1; tz++)
+    {
+        for (tx = tx0; tx <= tx1; tx++)
+        {
+            int err;
+            const int *tile = getTile(slot, l, tx, tz, &err);
+            if U(tile == NULL)
+                return err;
+
+            // intersection of the tile with the requested area
+            int ax = tx * n > x ? tx * n : x;
+            int az = tz * n > z ? tz * n : z;
+            int bx = (tx+1) * n < x + w ? (tx+1) * n : x + w;
+            int bz = (tz+1) * n < z + h ? (tz+1) * n : z + h;
+
+            for (j = az; j < bz; j++)
+            {
+                memcpy(&out[(j - z) * w + (ax - x)],
+                        &tile[(j - tz * n) * n + (ax - tx * n)],
+                        (bx - ax) * sizeof(int));
+            }
+        }
+    }
+
+    return 0;
+}
+
+int initTileCache(TileCache *tc, int tileSize, size_t maxBytes)
+{
+    memset(tc, 0, sizeof(*tc));
+    if (tileSize <= 0)
+        tileSize = TILE_CACHE_SIZE;
+    tc->tileSize = tileSize;
+
+    size_t bytes = sizeof(int) * tileSize * tileSize + sizeof(TileEntry);
+    size_t n = maxBytes / bytes;
+    if (n < 1)
+        n = 1;
+    if (n > 1 << 24)
+        n = 1 << 24;
+    tc->maxEntries = (int) n;
+
+    tc->nbuckets = 1;
+    while (tc->nbuckets < tc->maxEntries)
+        tc->nbuckets <<= 1;
+
+    tc->entries = (TileEntry *) calloc(tc->maxEntries, sizeof(TileEntry));
+    tc->buckets = (TileEntry **) calloc(tc->nbuckets, sizeof(TileEntry *));
+    if (tc->entries == NULL || tc->buckets == NULL)
+    {
+        freeTileCache(tc);
+        return -1;
+    }
+    return 0;
+}
+
+int attachTileCache(TileCache *tc, Layer *layer)
+{
+    if (tc->nslots >= TILE_CACHE_MAX_LAYERS || layer->getMap == mapTileCache)
+        return -1;
+
+    TileCacheSlot *slot = &tc->slots[tc->nslots];
+    slot->tc = tc;
+    slot->layer = layer;
+    slot->getMap = layer->getMap;
+    slot->data = layer->data;
+    slot->valid = 0;
+    slot->buf = (int *) malloc(sizeof(int) *
+            getRequiredBuf(layer, tc->tileSize, tc->tileSize));
+    if (slot->buf == NULL)
+        return -1;
+
+    tc->nslots++;
+    layer->getMap = mapTileCache;
+    layer->data = slot;
+    return 0;
+}
+
+void freeTileCache(TileCache *tc)
+{
+    int i;
+
+    for (i = 0; i < tc->nslots; i++)
+    {
+        TileCacheSlot *slot = &tc->slots[i];
+        slot->layer->getMap = slot->getMap;
+        slot->layer->data = slot->data;
+        free(slot->buf);
+    }
+    for (i = 0; i < tc->nentries; i++)
+        free(tc->entries[i].tile);
+    free(tc->entries);
+    free(tc->buckets);
+    memset(tc, 0, sizeof(*tc));
+}
+
+
+//==============================================================================
+// Viewport
+//==============================================================================
+
+/* A viewport keeps the window of every ancestor layer that its last area
+ * needed, as the engine of the point queries does for one request. The
+ * windows are stored as tori: the cell (x,z) of a window is at the row z and
+ * column x modulo the dimensions of the buffer. After a move, the overlap of
+ * the old and new window therefore stays where it is, and each layer (parents
+ * first) only generates the cells that are newly exposed, from the updated
+ * windows of its parents.
+ */
+struct Viewport
+{
+    MemoEngine e;
+    const Layer *layer;
+    int64_t seed;
+    int w, h;
+    int valid;
+    int tw[MEMO_MAX_NODES];     // dimensions of the torus of each node
+    int th[MEMO_MAX_NODES];
+    int *scratch;
+    size_t scratchcap;
+    int *out;
+};
+
+static inline int modPos(int a, int m)
+{
+    a %= m;
+    return a < 0 ? a + m : a;
+}
+
+/* Copies between a row of a torus and a linear buffer. */
+static inline void copyTorusRow(int *torus, int tw, int x, int *row, int w,
+        int toTorus)
+{
+    int i = modPos(x, tw);
+    int n = tw - i < w ? tw - i : w;
+    if (toTorus)
+    {
+        memcpy(&torus[i], row, n*sizeof(int));
+        memcpy(torus, row + n, (w - n)*sizeof(int));
+    }
+    else
+    {
+        memcpy(row, &torus[i], n*sizeof(int));
+        memcpy(row + n, torus, (w - n)*sizeof(int));
+    }
+}
+
+static int mapViewport(const Layer *l, int *out, int x, int z, int w, int h)
+{
+    MemoNode *nd = (MemoNode *) l->data;
+    Viewport *vp = (Viewport *) nd->e; // the engine starts the viewport
+    int k = nd - vp->e.nodes;
+    int j;
+
+    if U(x < nd->x || z < nd->z ||
+         x + w > nd->x + nd->w || z + h > nd->z + nd->h)
+    {
+        return genFallback(nd->layer, out, x, z, w, h);
+    }
+
+    for (j = 0; j < h; j++)
+    {
+        int *row = &nd->win[modPos(z + j, vp->th[k]) * vp->tw[k]];
+        copyTorusRow(row, vp->tw[k], x, &out[j*w], w, 0);
+    }
+    return 0;
+}
+
+static int reserveInts(int **buf, size_t *cap, size_t n)
+{
+    if (n <= *cap)
+        return 0;
+    int *p = (int *) realloc(*buf, n * sizeof(int));
+    if (p == NULL)
+        return -1;
+    *buf = p;
+    *cap = n;
+    return 0;
+}
+
+/* Generates a rectangle of the new window of a node into its torus. */
+static int genViewportRect(Viewport *vp, int k, int x, int z, int w, int h)
+{
+    MemoNode *nd = &vp->e.nodes[k];
+    Layer shadow;
+    int j, err;
+
+    if (w <= 0 || h <= 0)
+        return 0;
+    copyMemoLayer(&vp->e, nd, &shadow);
+    err = getLayerMap(&shadow, vp->scratch, x, z, w, h);
+    if U(err != 0)
+        return err;
+    for (j = 0; j < h; j++)
+    {
+        int *row = &nd->win[modPos(z + j, vp->th[k]) * vp->tw[k]];
+        copyTorusRow(row, vp->tw[k], x, &vp->scratch[j*w], w, 1);
+    }
+    return 0;
+}
+
+Viewport *createViewport(const Layer *layer, int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return NULL;
+
+    Viewport *vp = (Viewport *) calloc(1, sizeof(Viewport));
+    if (vp == NULL)
+        return NULL;
+
+    vp->layer = layer;
+    vp->w = width;
+    vp->h = height;
+    vp->out = (int *) malloc((size_t)width * height * sizeof(int));
+    if (vp->out == NULL || addMemoNode(&vp->e, layer, getMemoKey(layer), mapViewport) < 0)
+    {
+        free(vp->out);
+        free(vp);
+        return NULL;
+    }
+    vp->seed = layer->worldSeed;
+    return vp;
+}
+
+void freeViewport(Viewport *vp)
+{
+    int i;
+
+    if (vp == NULL)
+        return;
+    for (i = 0; i < vp->e.n; i++)
+        free(vp->e.nodes[i].win);
+    free(vp->scratch);
+    free(vp->out);
+    free(vp);
+}
+
+const int *moveViewport(Viewport *vp, int x, int z)
+{
+    MemoEngine *e = &vp->e;
+    int ox[MEMO_MAX_NODES], oz[MEMO_MAX_NODES];
+    int ow[MEMO_MAX_NODES], oh[MEMO_MAX_NODES];
+    size_t scratch = 0;
+    int i;
+
+    if (vp->layer->worldSeed != vp->seed)
+    {
+        // the nodes initialise the noise of their layers when they are added
+        for (i = 0; i < e->n; i++)
+        {
+            free(e->nodes[i].win);
+            vp->tw[i] = vp->th[i] = 0;
+        }
+        e->n = 0;
+        if (addMemoNode(e, vp->layer, getMemoKey(vp->layer), mapViewport) < 0)
+            return NULL;
+        vp->seed = vp->layer->worldSeed;
+        vp->valid = 0;
+    }
+
+    for (i = 0; i < e->n; i++)
+    {
+        MemoNode *nd = &e->nodes[i];
+        ox[i] = nd->x; oz[i] = nd->z; ow[i] = nd->w; oh[i] = nd->h;
+    }
+
+    propagateMemoRects(e, x, z, vp->w, vp->h);
+
+    for (i = 0; i < e->n; i++)
+    {
+        MemoNode *nd = &e->nodes[i];
+        size_t s = getShallowBuf(nd->layer, nd->w, nd->h);
+        if (s > scratch)
+            scratch = s;
+
+        // the windows vary slightly in size with their alignment to the zooms
+        if (nd->w > vp->tw[i] || nd->h > vp->th[i])
+        {
+            int tw = nd->w + 2, th = nd->h + 2;
+            free(nd->win);
+            nd->win = (int *) malloc((size_t)tw * th * sizeof(int));
+            vp->tw[i] = tw;
+            vp->th[i] = th;
+            ow[i] = 0; // nothing is kept
+            if (nd->win == NULL)
+            {
+                vp->tw[i] = vp->th[i] = 0;
+                goto fail;
+            }
+        }
+    }
+    if (reserveInts(&vp->scratch, &vp->scratchcap, scratch))
+        goto fail;
+
+    for (i = 0; i < e->n; i++)
+    {
+        MemoNode *nd = &e->nodes[i];
+
+        // overlap of the old and the new window
+        int x0 = ox[i] > nd->x ? ox[i] : nd->x;
+        int z0 = oz[i] > nd->z ? oz[i] : nd->z;
+        int x1 = ox[i] + ow[i] < nd->x + nd->w ? ox[i] + ow[i] : nd->x + nd->w;
+        int z1 = oz[i] + oh[i] < nd->z + nd->h ? oz[i] + oh[i] : nd->z + nd->h;
+
+        if (!vp->valid || x0 >= x1 || z0 >= z1)
+        {
+            if (genViewportRect(vp, i, nd->x, nd->z, nd->w, nd->h))
+                goto fail;
+        }
+        else
+        {
+            // the exposed rows above and below, and the columns beside
+            if (genViewportRect(vp, i, nd->x, nd->z, nd->w, z0 - nd->z) ||
+                genViewportRect(vp, i, nd->x, z1, nd->w, nd->z + nd->h - z1) ||
+                genViewportRect(vp, i, nd->x, z0, x0 - nd->x, z1 - z0) ||
+                genViewportRect(vp, i, x1, z0, nd->x + nd->w - x1, z1 - z0))
+                goto fail;
+        }
+    }
+
+    vp->valid = 1;
+    if (mapViewport(&e->nodes[e->n-1].proxy, vp->out, x, z, vp->w, vp->h))
+        goto fail;
+    return vp->out;
+
+fail:
+    vp->valid = 0;
+    return NULL;
+}
+
+
+//==============================================================================
+// Masked Areas
+//==============================================================================
+
+/* The cells of a masked area are generated in blocks of MASK_BLOCK cells per
+ * side, at every layer. The blocks of the target layer that hold cells of the
+ * mask are marked, and each layer marks the blocks of its parents that its
+ * marked blocks read, including their edges. The marked blocks are then
+ * generated once, from the ancestors to the target, so that the work is in
+ * proportion to the masked area rather than to its bounding rectangle. The
+ * blocks of a layer are recycled once its last child has been generated.
+ */
+#define MASK_BLOCK  16
+
+static int maskMarked; // placeholder of a marked block before its generation
+#define MASK_MARKED (&maskMarked)
+
+STRUCT(MaskEngine)
+{
+    MemoEngine e;
+    int gx[MEMO_MAX_NODES];     // grid of blocks that covers the window
+    int gz[MEMO_MAX_NODES];
+    int gw[MEMO_MAX_NODES];
+    int gh[MEMO_MAX_NODES];
+    int **blocks[MEMO_MAX_NODES]; // marked blocks, NULL otherwise
+    int last[MEMO_MAX_NODES];   // last node that reads from a node
+    int **pool;                 // blocks that can be reused
+    int npool, poolcap;
+    int *scratch;
+};
+
+/* Clips a block of a node to the window of the node. */
+static void getMaskBlockRect(const MemoNode *nd, int bx, int bz,
+        int *x, int *z, int *w, int *h)
+{
+    int x0 = bx * MASK_BLOCK, z0 = bz * MASK_BLOCK;
+    int x1 = x0 + MASK_BLOCK, z1 = z0 + MASK_BLOCK;
+    if (x0 < nd->x) x0 = nd->x;
+    if (z0 < nd->z) z0 = nd->z;
+    if (x1 > nd->x + nd->w) x1 = nd->x + nd->w;
+    if (z1 > nd->z + nd->h) z1 = nd->z + nd->h;
+    *x = x0; *z = z0; *w = x1 - x0; *h = z1 - z0;
+}
+
+/* Marks the blocks of a node that overlap with an area of its window. */
+static void markMaskBlocks(MaskEngine *m, int k, int x, int z, int w, int h)
+{
+    int bx, bz;
+    for (bz = floorDiv(z, MASK_BLOCK); bz <= floorDiv(z + h - 1, MASK_BLOCK); bz++)
+    {
+        int **row = &m->blocks[k][(bz - m->gz[k]) * m->gw[k] - m->gx[k]];
+        for (bx = floorDiv(x, MASK_BLOCK); bx <= floorDiv(x + w - 1, MASK_BLOCK); bx++)
+            row[bx] = MASK_MARKED;
+    }
+}
+
+/* Returns the blocks of a node to the pool. */
+static int releaseMaskBlocks(MaskEngine *m, int k)
+{
+    int j;
+    for (j = 0; j < m->gw[k] * m->gh[k]; j++)
+    {
+        int *b = m->blocks[k][j];
+        if (b == NULL || b == MASK_MARKED)
+            continue;
+        if (m->npool == m->poolcap)
+        {
+            int cap = m->poolcap ? 2 * m->poolcap : 256;
+            int **pool = (int **) realloc(m->pool, cap * sizeof(int *));
+            if (pool == NULL)
+                return -1;
+            m->pool = pool;
+            m->poolcap = cap;
+        }
+        m->pool[m->npool++] = b;
+        m->blocks[k][j] = NULL;
+    }
+    return 0;
+}
+
+static int mapMaskBlocks(const Layer *l, int *out, int x, int z, int w, int h)
+{
+    MemoNode *nd = (MemoNode *) l->data;
+    MaskEngine *m = (MaskEngine *) nd->e; // the engine starts the mask engine
+    int k = nd - m->e.nodes;
+    int bx, bz, j;
+
+    if U(x < nd->x || z < nd->z ||
+         x + w > nd->x + nd->w || z + h > nd->z + nd->h)
+    {
+        return genFallback(nd->layer, out, x, z, w, h);
+    }
+
+    for (bz = floorDiv(z, MASK_BLOCK); bz <= floorDiv(z + h - 1, MASK_BLOCK); bz++)
+    {
+        for (bx = floorDiv(x, MASK_BLOCK); bx <= floorDiv(x + w - 1, MASK_BLOCK); bx++)
+        {
+            const int *b = m->blocks[k][(bz - m->gz[k]) * m->gw[k] + (bx - m->gx[k])];
+            if U(b == NULL || b == MASK_MARKED)
+                return genFallback(nd->layer, out, x, z, w, h);
+
+            // intersection of the block with the requested area
+            int bx0 = bx * MASK_BLOCK, bz0 = bz * MASK_BLOCK;
+            int ax = bx0 > x ? bx0 : x;
+            int az = bz0 > z ? bz0 : z;
+            int ex = bx0 + MASK_BLOCK < x + w ? bx0 + MASK_BLOCK : x + w;
+            int ez = bz0 + MASK_BLOCK < z + h ? bz0 + MASK_BLOCK : z + h;
+
+            for (j = az; j < ez; j++)
+            {
+                memcpy(&out[(j - z) * w + (ax - x)],
+                        &b[(j - bz0) * MASK_BLOCK + (ax - bx0)],
+                        (ex - ax) * sizeof(int));
+            }
+        }
+    }
+    return 0;
+}
+
+static void freeMaskEngine(MaskEngine *m)
+{
+    int i;
+    for (i = 0; i < m->e.n; i++)
+    {
+        if (m->blocks[i] == NULL)
+            continue;
+        releaseMaskBlocks(m, i);
+        free(m->blocks[i]);
+    }
+    for (i = 0; i < m->npool; i++)
+        free(m->pool[i]);
+    free(m->pool);
+    free(m->scratch);
+    free(m);
+}
+
+int genAreaMasked(const Layer *layer, int *out, const uint8_t *mask,
+        int areaX, int areaZ, int areaWidth, int areaHeight)
+{
+    MaskEngine *m = (MaskEngine *) calloc(1, sizeof(MaskEngine));
+    MemoEngine *e = &m->e;
+    size_t scratch = 0;
+    int i, j, k, bx, bz, err = 0;
+
+    if U(m == NULL)
+        return -1;
+    if (addMemoNode(e, layer, getMemoKey(layer), mapMaskBlocks) < 0)
+    {
+        free(m);
+        return genFallback(layer, out, areaX, areaZ, areaWidth, areaHeight);
+    }
+
+    propagateMemoRects(e, areaX, areaZ, areaWidth, areaHeight);
+    for (i = 0; i < e->n; i++)
+    {
+        MemoNode *nd = &e->nodes[i];
+        m->last[i] = i;
+        if (nd->ip >= 0)
+            m->last[nd->ip] = i;
+        if (nd->ip2 >= 0)
+            m->last[nd->ip2] = i;
+        if (nd->w == 0)
+            continue; // generated the usual way by its children
+
+        m->gx[i] = floorDiv(nd->x, MASK_BLOCK);
+        m->gz[i] = floorDiv(nd->z, MASK_BLOCK);
+        m->gw[i] = floorDiv(nd->x + nd->w - 1, MASK_BLOCK) - m->gx[i] + 1;
+        m->gh[i] = floorDiv(nd->z + nd->h - 1, MASK_BLOCK) - m->gz[i] + 1;
+        m->blocks[i] = (int **) calloc((size_t)m->gw[i] * m->gh[i], sizeof(int *));
+        if U(m->blocks[i] == NULL)
+            goto fail;
+        size_t s = getShallowBuf(nd->layer, nd->w, MASK_BLOCK);
+        if (s > scratch)
+            scratch = s;
+    }
+    m->scratch = (int *) malloc(scratch * sizeof(int));
+    if U(m->scratch == NULL)
+        goto fail;
+
+    // mark the blocks of the target that hold cells of the mask
+    k = e->n - 1;
+    for (j = 0; j < areaHeight; j++)
+    {
+        const uint8_t *row = &mask[(size_t)j * areaWidth];
+        for (i = 0; i < areaWidth; i++)
+        {
+            if (!row[i])
+                continue;
+            // the mask of the rest of this block is irrelevant
+            int x1 = (floorDiv(areaX + i, MASK_BLOCK) + 1) * MASK_BLOCK;
+            markMaskBlocks(m, k, areaX + i, areaZ + j, 1, 1);
+            i = x1 - areaX - 1;
+        }
+    }
+
+    // The blocks are slower than one area, which is preferred once half of
+    // the blocks are needed anyway.
+    for (i = j = 0; i < m->gw[k] * m->gh[k]; i++)
+        j += m->blocks[k][i] != NULL;
+    if (2 * j >= m->gw[k] * m->gh[k])
+    {
+        freeMaskEngine(m);
+        return genFallback(layer, out, areaX, areaZ, areaWidth, areaHeight);
+    }
+
+    // mark the blocks that the marked blocks read from their parents
+    for (i = e->n - 1; i >= 0; i--)
+    {
+        MemoNode *nd = &e->nodes[i];
+        int par[2] = { nd->ip, nd->ip2 };
+
+        for (j = 0; j < m->gw[i] * m->gh[i]; j++)
+        {
+            if (m->blocks[i][j] == NULL)
+                continue;
+            int x, z, w, h;
+            getMaskBlockRect(nd, m->gx[i] + j % m->gw[i], m->gz[i] + j / m->gw[i],
+                    &x, &z, &w, &h);
+            for (k = 0; k < 2; k++)
+            {
+                if (par[k] < 0 || m->blocks[par[k]] == NULL)
+                    continue;
+                int px, pz, pw, ph;
+                getParentRect(nd->layer, k, x, z, w, h, &px, &pz, &pw, &ph);
+                markMaskBlocks(m, par[k], px, pz, pw, ph);
+            }
+        }
+    }
+
+    // Generate the marked blocks from the ancestors to the target. The runs of
+    // marked blocks within a row are generated together, for longer rows.
+    for (i = 0; i < e->n; i++)
+    {
+        MemoNode *nd = &e->nodes[i];
+        Layer shadow;
+        copyMemoLayer(e, nd, &shadow);
+
+        for (bz = 0; bz < m->gh[i]; bz++)
+        {
+            int **row = &m->blocks[i][bz * m->gw[i]];
+            for (bx = 0; bx < m->gw[i]; bx = j)
+            {
+                if (row[bx] == NULL)
+                {
+                    j = bx + 1;
+                    continue;
+                }
+                for (j = bx + 1; j < m->gw[i] && row[j] != NULL; j++);
+
+                int x, z, w, h, x1, z1, w1, h1;
+                getMaskBlockRect(nd, m->gx[i] + bx, m->gz[i] + bz, &x, &z, &w, &h);
+                getMaskBlockRect(nd, m->gx[i] + j-1, m->gz[i] + bz, &x1, &z1, &w1, &h1);
+                w = x1 + w1 - x;
+                err = getLayerMap(&shadow, m->scratch, x, z, w, h);
+                if U(err != 0)
+                    goto done;
+
+                if (i == e->n - 1)
+                {
+                    for (k = 0; k < h; k++)
+                    {
+                        memcpy(&out[(z - areaZ + k) * areaWidth + (x - areaX)],
+                                &m->scratch[k * w], w * sizeof(int));
+                    }
+                    continue;
+                }
+
+                // distribute the run over its blocks
+                int b0 = (m->gz[i] + bz) * MASK_BLOCK;
+                for (k = bx; k < j; k++)
+                {
+                    int *b;
+                    if (m->npool > 0)
+                        b = m->pool[--m->npool];
+                    else if ((b = (int *) malloc(MASK_BLOCK * MASK_BLOCK * sizeof(int))) == NULL)
+                        goto fail;
+                    row[k] = b;
+
+                    int c0 = (m->gx[i] + k) * MASK_BLOCK;
+                    int cx = c0 > x ? c0 : x;
+                    int cw = (c0 + MASK_BLOCK < x + w ? c0 + MASK_BLOCK : x + w) - cx;
+                    for (z1 = 0; z1 < h; z1++)
+                    {
+                        memcpy(&b[(z - b0 + z1) * MASK_BLOCK + (cx - c0)],
+                                &m->scratch[z1 * w + (cx - x)], cw * sizeof(int));
+                    }
+                }
+            }
+        }
+
+        // the parents that no other layer reads from are no longer needed
+        for (k = 0; k < i; k++)
+        {
+            if (m->last[k] == i && m->blocks[k] && releaseMaskBlocks(m, k))
+                goto fail;
+        }
+    }
+
+done:
+    freeMaskEngine(m);
+    return err;
+fail:
+    freeMaskEngine(m);
+    return -1;
+}
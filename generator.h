@@ -89,6 +89,132 @@ STRUCT(LayerStack)
 
 typedef int (*mapfunc_t)(const Layer *, int *, int, int, int, int);
 
+/* Receives a finished part of a streamed area, with the biomeIDs indexed as
+ * ids[i + j*w] for the position (x+i, z+j). A non-zero return value stops
+ * the generation, and is returned by genAreaStream().
+ */
+typedef int (*stripfunc_t)(void *data, const int *ids, int x, int z, int w, int h);
+
+// default strip height of genAreaStream()
+#define STREAM_STRIP_HEIGHT 64
+
+// default tile size of genAreaParallel(): large enough that the overlap,
+// which each tile regenerates, is a small fraction of the work
+#define PARALLEL_TILE_SIZE 512
+
+// parts of genAreaPacked(), generated one at a time: up to this many columns,
+// and as many rows as fit into the number of cells
+#define PACKED_PART_WIDTH   1024
+#define PACKED_PART_CELLS   (1 << 18)
+
+/* A layer context holds the seed dependent state of a generator for a single
+ * thread. Its 'stack' is a view of the layers of a shared generator 'config',
+ * linked to each other and to the ocean noise of the context. The seeds, the
+ * noise and the temporary layer filters of functions such as
+ * isViableStructurePos() and checkForBiomes() only ever modify the view, so
+ * the configuration stays unchanged and any number of threads can work from
+ * it, each with a context of its own. Pass &ctx->stack wherever a LayerStack
+ * is expected.
+ */
+STRUCT(LayerContext)
+{
+    const LayerStack *config;   // shared generator, read-only
+    LayerStack stack;           // layer views with the state of this thread
+};
+
+/* A workspace is a single arena that holds the output of a generated area
+ * together with the intermediate buffers of all the layers it depends on.
+ * Once it is large enough for the biggest area that is requested, repeated
+ * generation does not touch the heap.
+ */
+STRUCT(LayerWorkspace)
+{
+    int *buf;       // arena, the generated area is stored at the start
+    size_t size;    // number of ints available in 'buf'
+};
+
+/* A step of a LayerPlan: the area that is generated for a layer, and the
+ * range of the buffer that it uses, which starts with its output. The zooms
+ * that are generated together with the layer of a step have no step of their
+ * own.
+ */
+STRUCT(LayerPlanStep)
+{
+    const Layer *layer;
+    int x, z, w, h;     // area in cells of the layer
+    size_t offset;      // start of the output, in ints from the buffer start
+    size_t size;        // ints used from 'offset', including the parents
+};
+
+/* The execution plan of a generated area (see planArea()), with the steps in
+ * the order they are entered, starting with the requested layer.
+ */
+STRUCT(LayerPlan)
+{
+    LayerPlanStep *steps;
+    int n;
+    size_t size;        // total buffer size in ints
+};
+
+// default tile size of a TileCache, in cells of the cached layer
+#define TILE_CACHE_SIZE 64
+// maximum number of layers that can be attached to a TileCache
+#define TILE_CACHE_MAX_LAYERS 8
+
+STRUCT(TileCacheSlot)
+{
+    struct TileCache *tc;
+    Layer *layer;           // the cached layer
+    mapfunc_t getMap;       // original map function and data of the layer
+    void *data;
+    int64_t seed;           // world seed of the cached tiles
+    int valid;              // whether there are tiles for 'seed'
+    int *buf;               // buffer to generate a tile
+};
+
+/* A cache of generated tiles that is consulted by the layers it is attached
+ * to, for example by repeated and overlapping requests on the same seed, as
+ * they are made by findStrongholds() or getSpawn(). The tiles are kept for
+ * the current world seed of each layer, and evicted in least recently used
+ * order once the memory cap is reached. A cache can only be used by one
+ * thread at a time, which includes the contexts that are copied from a
+ * generator with an attached cache. genAreaParallel() generates the areas
+ * that reach a cached layer in the calling thread alone.
+ */
+STRUCT(TileCache)
+{
+    int tileSize;
+    int nslots;
+    TileCacheSlot slots[TILE_CACHE_MAX_LAYERS];
+
+    struct TileEntry *entries;  // entry pool, with at most 'maxEntries'
+    struct TileEntry **buckets; // hash table of the used entries
+    struct TileEntry *lru;      // least recently used entry
+    struct TileEntry *mru;      // most recently used entry
+    struct TileEntry *unused;   // entries that were dropped with their seed
+    int maxEntries, nentries, nbuckets;
+
+    uint64_t hits;          // number of tile requests that were cached
+    uint64_t misses;        // number of tiles that had to be generated
+    uint64_t evictions;     // number of tiles that were dropped for the cap
+};
+
+/* One of the layers that genAreaTaps() generates, with its area in cells of
+ * the layer (see Layer.scale) and the buffer 'out' of at least w*h cells
+ * that receives it, indexed as out[i + j*w].
+ */
+STRUCT(LayerTap)
+{
+    const Layer *layer;
+    int *out;
+    int x, z, w, h;
+};
+
+/* A viewport onto a layer that remembers its last area (see moveViewport()).
+ * Its contents are private to the generator.
+ */
+typedef struct Viewport Viewport;
+
 
 #ifdef __cplusplus
 extern "C"
@@ -101,25 +227,80 @@ void setupGenerator(LayerStack *g, int mcversion);
 /* Initialise an instance of a generator with largeBiomes configuration. */
 void setupLargeBiomesGenerator(LayerStack *g, int mcversion);
 
+/* Initialise an instance of a generator that approximates the biomes, with
+ * one of the following levels of the approximation:
+ *  APPROX_SCALE_4  - leaves out the shores and the smoothing layers of the
+ *                    1:4 scale and stretches it to 1:1 instead of the voronoi
+ *                    zoom;
+ *  APPROX_SCALE_64 - also stretches the hills layer (1:64) to 1:4, which
+ *                    leaves out the rare biomes, the islands of the 1:32
+ *                    scale, the rivers and the ocean variants of 1.13+.
+ * It is meant to prefilter the seeds of a search ahead of the exact generator:
+ * the approximate areas differ in their outline, lack the biomes of the layers
+ * that are left out and can have a few biomes that the exact area lacks.
+ * Compared to the exact generator on 64x64 areas of 200 seeds:
+ *
+ *                      APPROX_SCALE_4           APPROX_SCALE_64
+ *  version          1:4    1:1  missing       1:4    1:1  missing
+ *  1.7 - 1.12       6.3%   9.5%   11.5%      40.1%  41.7%   33.5%
+ *  1.13 - 1.16      6.3%  10.0%   10.6%      52.7%  53.4%   43.9%
+ *
+ * where 1:4 and 1:1 are the shares of the cells that differ and 'missing' is
+ * the share of the biomes of an exact area that the approximate area lacks.
+ * Large biomes are not supported.
+ */
+enum { APPROX_SCALE_4 = 1, APPROX_SCALE_64 };
+void setupApproxGenerator(LayerStack *g, int mcversion, int approx);
+
 
 /* Calculates the minimum size of the buffers required to generate an area of
- * dimensions 'sizeX' by 'sizeZ' at the specified layer.
+ * dimensions 'sizeX' by 'sizeZ' at the specified layer, at any position. This
+ * includes the scratch space that the layers use beyond the generated area.
  */
 int calcRequiredBuf(const Layer *layer, int areaX, int areaZ);
 
+/* Plans the generation of an area of a layer at its position: the area each
+ * layer generates, where in the buffer it goes and the exact buffer size. The
+ * plan has to be released with freeLayerPlan().
+ * Returns non-zero if the allocation failed.
+ */
+int planArea(LayerPlan *plan, const Layer *layer, int areaX, int areaZ, int areaWidth, int areaHeight);
+void freeLayerPlan(LayerPlan *plan);
+
 /* Allocates an amount of memory required to generate an area of dimensions
  * 'sizeX' by 'sizeZ' for the magnification of the given layer.
  */
 int *allocCache(const Layer *layer, int sizeX, int sizeZ);
 
+/* Workspace management: initWorkspace() creates an empty workspace and
+ * reserveWorkspace() grows it, as necessary, to fit an area of 'sizeX' by
+ * 'sizeZ' at the given layer. Returns non-zero if the allocation failed.
+ */
+void initWorkspace(LayerWorkspace *ws);
+int reserveWorkspace(LayerWorkspace *ws, const Layer *layer, int sizeX, int sizeZ);
+void freeWorkspace(LayerWorkspace *ws);
+
 
 /* Set up custom layers. */
 void setupLayer(Layer *l, Layer *p, int s, mapfunc_t getMap);
 void setupMultiLayer(Layer *l, Layer *p1, Layer *p2, int s, mapfunc_t getMap);
 
-/* Sets the world seed for the generator */
+/* Sets the world seed for the generator. The ocean noise of 1.13+ is
+ * initialised for the seed on its first generation, once, even when several
+ * threads generate from the generator at the same time.
+ */
 void applySeed(LayerStack *g, int64_t seed);
 
+/* Initialises a context for the generator 'config', which has to be set up
+ * already. This only copies and relinks the layers: the generator does not
+ * have to be set up again, and the context has noise of its own, which is
+ * initialised on demand once a seed is applied to the context.
+ */
+void initLayerContext(LayerContext *ctx, const LayerStack *config);
+
+/* Sets the world seed for a context. */
+void applyContextSeed(LayerContext *ctx, int64_t seed);
+
 /* Generates the specified area using the current generator settings and stores
  * the biomeIDs in 'out'.
  * The biomeIDs will be indexed in the form: out[x + z*areaWidth]
@@ -128,6 +309,147 @@ void applySeed(LayerStack *g, int64_t seed);
  */
 int genArea(const Layer *layer, int *out, int areaX, int areaZ, int areaWidth, int areaHeight);
 
+/* Generates the specified area into the workspace 'ws', which is grown first
+ * if it is too small for the plan of the area (see planArea()). With DEBUG
+ * defined, the space after the plan is guarded and checked after generation.
+ * The biomeIDs are stored at the start of ws->buf.
+ * Returns non-zero if the generation or the allocation failed.
+ */
+int genAreaWs(const Layer *layer, LayerWorkspace *ws, int areaX, int areaZ, int areaWidth, int areaHeight);
+
+/* Generates an area like genArea(), but split into tiles of up to 'tileSize'
+ * cells per side, which are generated by 'threads' workers. Each tile asks
+ * its parents for the overlap that their edges require, so the result is
+ * identical to that of genArea(). The output 'out' only needs to hold the
+ * area itself, as the workers allocate their own buffers, and the layers are
+ * only read. A 'tileSize' <= 0 selects PARALLEL_TILE_SIZE. An area that
+ * depends on a layer with an attached TileCache is generated by the calling
+ * thread alone, as a cache cannot be shared between threads.
+ * The calling thread is one of the workers, and it also takes over the tiles
+ * of any worker that cannot be started. The workers are started for each
+ * call rather than kept in a pool: a tile takes far longer to generate than a
+ * thread takes to start, and a pool would need global state with its own
+ * setup and shutdown, which the library otherwise does without.
+ * Returns non-zero if the generation or an allocation failed.
+ */
+int genAreaParallel(const Layer *layer, int *out, int areaX, int areaZ,
+        int areaWidth, int areaHeight, int tileSize, int threads);
+
+/* Generates a large area in parts, which are passed to 'callback' as they are
+ * finished. The area is split into bands of up to 'bandWidth' columns (all
+ * of them if <= 0), and each band is generated from top to bottom in strips
+ * of 'stripHeight' rows (STREAM_STRIP_HEIGHT if <= 0). The ancestor layers
+ * keep the rows that the next strip needs from them, so the overlap between
+ * the strips of a band is only generated once. The memory depends on the
+ * size of the bands and the strips, but not on the size of the area, nor on
+ * its distance from the origin. A band whose rows cannot be kept at some
+ * layer (as for the large biomes far out) is generated in independent strips.
+ * Returns non-zero if the generation or an allocation failed, or the return
+ * value of the callback that stopped the generation.
+ */
+int genAreaStream(const Layer *layer, int areaX, int areaZ, int areaWidth,
+        int areaHeight, int bandWidth, int stripHeight,
+        stripfunc_t callback, void *data);
+
+/* Returns the number of bytes (1, 2 or 4) that are enough to hold every value
+ * that the layer can produce: the biomeIDs fit into one byte, the climates
+ * with the special flags (0xf00) of mapSpecial into two, and the river noise
+ * needs the full width.
+ */
+int getLayerCellBytes(const Layer *layer);
+
+/* Generates the specified area like genArea(), but packs the values into
+ * 'cellBytes' bytes per cell, as uint8_t (1), uint16_t (2) or int (4), with
+ * the same indexing, for maps that are kept in memory. Only the output is
+ * packed: the layers still generate int rows, in parts of up to
+ * PACKED_PART_WIDTH x (PACKED_PART_CELLS / width) cells, which are narrowed
+ * while they are in the cache. Beyond the output itself, the memory is that
+ * of one part (a few MB), whatever the size of the area. The parts are tall
+ * enough that regenerating their edges costs only a few percent over
+ * genArea(), which the streamed generation of genAreaStream() would exceed
+ * with the copies of its rows.
+ * Returns non-zero if 'cellBytes' is smaller than getLayerCellBytes() of the
+ * layer, or if the generation or an allocation failed.
+ */
+int genAreaPacked(const Layer *layer, void *out, int cellBytes,
+        int areaX, int areaZ, int areaWidth, int areaHeight);
+
+/* Initialises a tile cache with tiles of 'tileSize' cells per side
+ * (TILE_CACHE_SIZE if <= 0), which uses at most about 'maxBytes' of memory
+ * for the tiles, but at least enough for one tile.
+ * Returns non-zero if the allocation failed.
+ */
+int initTileCache(TileCache *tc, int tileSize, size_t maxBytes);
+
+/* Attaches the cache to a layer, which then serves its requests from the
+ * tiles of the cache, including the requests of its child layers. The layer
+ * has to be set up already (see setupGenerator()).
+ * Returns non-zero if the layer is already cached, the cache has no free
+ * slot or the allocation failed.
+ */
+int attachTileCache(TileCache *tc, Layer *layer);
+
+/* Detaches the cache from its layers and releases its memory. */
+void freeTileCache(TileCache *tc);
+
+/* Creates a viewport of 'width' by 'height' cells onto a layer, which has to
+ * stay valid while the viewport is used. Returns NULL if the layer graph is
+ * too large or the allocation failed.
+ */
+Viewport *createViewport(const Layer *layer, int width, int height);
+
+/* Moves the viewport to the area at (x,z) and returns its biomeIDs, which are
+ * indexed as ids[i + j*width] and remain valid until the next move. Every
+ * layer keeps the window that the last area needed, so a move by a few cells
+ * only generates the cells that are newly exposed, at each layer. A new world
+ * seed of the layer is noticed, and regenerates the whole area.
+ * Returns NULL if the generation or an allocation failed.
+ */
+const int *moveViewport(Viewport *vp, int x, int z);
+
+void freeViewport(Viewport *vp);
+
+/* Generates the areas of several layers in one traversal of the layer graph,
+ * for example the intermediate layers that an analysis looks at for the same
+ * region. Every cell of an ancestor that the taps share is generated once,
+ * and only the cells that the taps need are generated at all. Taps whose
+ * cells do not overlap at any layer, such as those of distant regions, are
+ * generated as separate groups, so the windows never span the gap between.
+ * Returns non-zero if the generation or an allocation failed.
+ */
+int genAreaTaps(const LayerTap *taps, int n);
+
+/* Generates the cells of an area that are set in 'mask', which is indexed
+ * like the output as mask[i + j*areaWidth], such as a circle or a corridor
+ * within the area. The cells that the masked cells depend on are carried up
+ * the layer graph, and only those are generated, in blocks, so the work is
+ * in proportion to the masked area. The output 'out' only has to hold the
+ * area itself, and the values of the cells outside the mask are unspecified.
+ * Returns non-zero if the generation or an allocation failed.
+ */
+int genAreaMasked(const Layer *layer, int *out, const uint8_t *mask,
+        int areaX, int areaZ, int areaWidth, int areaHeight);
+
+/* Generates the biomeID of a single position at the specified layer and
+ * stores it in 'out'. Only the cells of the ancestor layers that the position
+ * depends on are evaluated. The cells are held in a fixed arena of 32 KB on
+ * the stack, which fits all the versions of setupGenerator() and the large
+ * biomes up to 1.12. The large biomes of 1.13+ need up to about 34 KB, which
+ * is allocated instead for about half of the positions. Together with the
+ * engine and the layer functions, a call takes about 54 KB of stack.
+ * A layer graph of more than 80 nodes is generated the usual way, as by
+ * genArea().
+ * Returns non-zero if the generation or an allocation failed.
+ */
+int genPoint(const Layer *layer, int *out, int x, int z);
+
+/* Generates the biomeIDs of 'n' positions at the specified layer, where 'pos'
+ * holds the (x,z) coordinates of each position in turn. Nearby positions are
+ * clustered so that their common ancestor cells are only evaluated once.
+ * Returns non-zero if the generation of any of the positions failed.
+ */
+int genPoints(const Layer *layer, int *out, const int *pos, int n);
+
 
 
 static inline int isOverworldBiome(int mc, int id)
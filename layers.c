@@ -1,10 +1,15 @@
 #include "layers.h"
+#include "simd.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
 #include <float.h>
 
+#if !__GNUC__
+#include <intrin.h>
+#endif
+
 //==============================================================================
 // Essentials
 //==============================================================================
@@ -128,6 +133,8 @@ void initBiomes()
     initAddBiome(crimson_forest, Warm, Nether, 2.0, hDefault);
     initAddBiome(warped_forest, Warm, Nether, 2.0, hDefault);
     initAddBiome(basalt_deltas, Warm, Nether, 2.0, hDefault);
+
+    initSimdTables();
 }
 
 
@@ -139,23 +146,66 @@ void setLayerSeed(Layer *layer, int64_t worldSeed)
     if (layer->p != NULL)
         setLayerSeed(layer->p, worldSeed);
 
-    if (layer->noise != NULL)
+    // the noise is initialised when the layer is generated (see
+    // ensureLayerNoise), and is kept if the seed stays the same
+    if (layer->noise != NULL && layer->worldSeed != worldSeed)
+        layer->noiseState = LAYER_NOISE_NONE;
+    layer->worldSeed = worldSeed;
+
+    getLayerSeeds(layer->layerSalt, worldSeed,
+            &layer->startSalt, &layer->startSeed);
+}
+
+void applyLayerNoise(Layer *layer)
+{
+#if __GNUC__
+    int state = LAYER_NOISE_NONE;
+    if (__atomic_compare_exchange_n(&layer->noiseState, &state,
+            LAYER_NOISE_BUSY, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+#else
+    if (_InterlockedCompareExchange((volatile long *) &layer->noiseState,
+            LAYER_NOISE_BUSY, LAYER_NOISE_NONE) == LAYER_NOISE_NONE)
+#endif
     {
-        int64_t s;
-        setSeed(&s, worldSeed);
-        perlinInit((PerlinNoise*)layer->noise, &s);
+        if (layer->noise != NULL)
+        {
+            int64_t s;
+            setSeed(&s, layer->worldSeed);
+            perlinInit((PerlinNoise*)layer->noise, &s);
+        }
+#if __GNUC__
+        __atomic_store_n(&layer->noiseState, LAYER_NOISE_READY, __ATOMIC_RELEASE);
+#else
+        _InterlockedExchange((volatile long *) &layer->noiseState, LAYER_NOISE_READY);
+#endif
+        return;
+    }
+
+    // another thread is initialising the noise
+    while (1)
+    {
+#if __GNUC__
+        if (__atomic_load_n(&layer->noiseState, __ATOMIC_ACQUIRE) == LAYER_NOISE_READY)
+#else
+        if (*(volatile int *) &layer->noiseState == LAYER_NOISE_READY)
+#endif
+            return;
     }
+}
 
-    int64_t ls = layer->layerSalt;
+void getLayerSeeds(int64_t layerSalt, int64_t worldSeed,
+        int64_t *startSalt, int64_t *startSeed)
+{
+    int64_t ls = layerSalt;
     if (ls == 0) // Pre 1.13 the Hills branch stays zero-initialized
     {
-        layer->startSalt = 0;
-        layer->startSeed = 0;
+        *startSalt = 0;
+        *startSeed = 0;
     }
     else if (ls == -1) // Post 1.14 VoronoiZoom uses SHA256 for initialization
     {
-        layer->startSalt = getVoronoiSHA(worldSeed);
-        layer->startSeed = 0;
+        *startSalt = getVoronoiSHA(worldSeed);
+        *startSeed = 0;
     }
     else
     {
@@ -164,8 +214,8 @@ void setLayerSeed(Layer *layer, int64_t worldSeed)
         st = mcStepSeed(st, ls);
         st = mcStepSeed(st, ls);
 
-        layer->startSalt = st;
-        layer->startSeed = mcStepSeed(st, 0);
+        *startSalt = st;
+        *startSeed = mcStepSeed(st, 0);
     }
 }
 
@@ -486,12 +536,25 @@ static int getEndBiome(int hx, int hz, const uint16_t *hmap, int hw)
     return small_end_islands;
 }
 
-int mapEndBiome(const EndNoise *en, int *out, int x, int z, int w, int h)
+size_t getEndScratchSize(int scale, int w, int h)
+{
+    if (scale == 4)
+    {
+        // mapEnd: biome buffer at 1:16 followed by its height map
+        int cw = (w >> 2) + 2;
+        int ch = (h >> 2) + 2;
+        return cw * ch * sizeof(int) + getEndScratchSize(16, cw, ch);
+    }
+    return (w + 26) * (h + 26) * sizeof(uint16_t);
+}
+
+int mapEndBiomeBuf(const EndNoise *en, int *out, void *buf,
+        int x, int z, int w, int h)
 {
     int i, j;
     int hw = w + 26;
     int hh = h + 26;
-    uint16_t *hmap = (uint16_t*) malloc(hw * hh * sizeof(*hmap));
+    uint16_t *hmap = (uint16_t*) buf;
 
     for (j = 0; j < hh; j++)
     {
@@ -528,19 +591,19 @@ int mapEndBiome(const EndNoise *en, int *out, int x, int z, int w, int h)
         }
     }
 
-    free(hmap);
     return 0;
 }
 
-int mapEnd(const EndNoise *en, int *out, int x, int z, int w, int h)
+int mapEndBuf(const EndNoise *en, int *out, void *buf,
+        int x, int z, int w, int h)
 {
     int cx = x >> 2;
     int cz = z >> 2;
     int cw = ((x+w) >> 2) + 1 - cx;
     int ch = ((z+h) >> 2) + 1 - cz;
 
-    int *buf = (int*) malloc(cw * ch * sizeof(int));
-    mapEndBiome(en, buf, cx, cz, cw, ch);
+    int *cbuf = (int*) buf;
+    mapEndBiomeBuf(en, cbuf, cbuf + cw * ch, cx, cz, cw, ch);
 
     int i, j;
 
@@ -550,15 +613,30 @@ int mapEnd(const EndNoise *en, int *out, int x, int z, int w, int h)
         for (i = 0; i < w; i++)
         {
             int ci = ((x+i) >> 2) - cx;
-            int v = buf[cj*cw+ci];
+            int v = cbuf[cj*cw+ci];
             out[j*w+i] = v;
         }
     }
 
-    free(buf);
     return 0;
 }
 
+int mapEndBiome(const EndNoise *en, int *out, int x, int z, int w, int h)
+{
+    void *buf = malloc(getEndScratchSize(16, w, h));
+    int err = mapEndBiomeBuf(en, out, buf, x, z, w, h);
+    free(buf);
+    return err;
+}
+
+int mapEnd(const EndNoise *en, int *out, int x, int z, int w, int h)
+{
+    void *buf = malloc(getEndScratchSize(4, w, h));
+    int err = mapEndBuf(en, out, buf, x, z, w, h);
+    free(buf);
+    return err;
+}
+
 //==============================================================================
 // Layers
 //==============================================================================
@@ -595,14 +673,13 @@ int mapZoomIsland(const Layer * l, int * out, int x, int z, int w, int h)
     int pH = ((z + h) >> 1) - pZ + 1;
     int i, j;
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
     int newW = (pW) << 1;
-    int newH = (pH) << 1;
     int idx, v00, v01, v10, v11;
-    int *buf = (int*) malloc((newW+1)*(newH+1)*sizeof(*buf));
+    int *buf = out + pW * pH; // (newW * newH) of scratch after the parent area
 
     const int st = (int)l->startSalt;
     const int ss = (int)l->startSeed;
@@ -611,10 +688,15 @@ int mapZoomIsland(const Layer * l, int * out, int x, int z, int w, int h)
     {
         idx = (j << 1) * newW;
 
-        v00 = out[(j+0)*pW];
-        v01 = out[(j+1)*pW];
+        // vectorized cells first, the scalar loop completes the row
+        i = zoomRowSimd(&out[(j+0)*pW], &out[(j+1)*pW], &buf[idx], &buf[idx + newW],
+                pW, pX << 1, (j + pZ) << 1, ss, st, 1);
+        idx += i << 1;
+
+        v00 = out[i + (j+0)*pW];
+        v01 = out[i + (j+1)*pW];
 
-        for (i = 0; i < pW; i++, v00 = v10, v01 = v11)
+        for (; i < pW; i++, v00 = v10, v01 = v11)
         {
             v10 = out[i+1 + (j+0)*pW];
             v11 = out[i+1 + (j+1)*pW];
@@ -657,13 +739,12 @@ int mapZoomIsland(const Layer * l, int * out, int x, int z, int w, int h)
         }
     }
 
+    // rows can overlap with the scratch space for narrow areas
     for (j = 0; j < h; j++)
     {
-        memcpy(&out[j*w], &buf[(j + (z & 1))*newW + (x & 1)], w*sizeof(int));
+        memmove(&out[j*w], &buf[(j + (z & 1))*newW + (x & 1)], w*sizeof(int));
     }
 
-    free(buf);
-
     return 0;
 }
 
@@ -689,83 +770,184 @@ static inline int select4(int cs, int st, int v00, int v01, int v10, int v11)
     return v;
 }
 
+/* Zooms one row of parent cells at 'p0' (and the next row at 'p1') into the
+ * two rows 'b0' and 'b1' of twice the width. 'pX' and 'pZ' are the position
+ * of the first parent cell. The parent cells up to p0[pW] and p1[pW] are read.
+ */
+static inline void zoomRow(const int *p0, const int *p1, int *b0, int *b1,
+        int pW, int pX, int pZ, int ss, int st)
+{
+    int i, v00, v01, v10, v11;
+
+    // vectorized cells first, the scalar loop completes the row
+    i = zoomRowSimd(p0, p1, b0, b1, pW, pX << 1, pZ << 1, ss, st, 0);
+
+    v00 = p0[i];
+    v01 = p1[i];
+
+    for (; i < pW; i++, v00 = v10, v01 = v11)
+    {
+        v10 = p0[i+1];
+        v11 = p1[i+1];
+
+        if (v00 == v01 && v00 == v10 && v00 == v11)
+        {
+            b0[2*i] = v00;
+            b0[2*i+1] = v00;
+            b1[2*i] = v00;
+            b1[2*i+1] = v00;
+            continue;
+        }
+
+        int chunkX = (i + pX) << 1;
+        int chunkZ = pZ << 1;
+
+        int cs = ss;
+        cs += chunkX;
+        cs *= cs * 1284865837 + 4150755663;
+        cs += chunkZ;
+        cs *= cs * 1284865837 + 4150755663;
+        cs += chunkX;
+        cs *= cs * 1284865837 + 4150755663;
+        cs += chunkZ;
+
+        b0[2*i] = v00;
+        b1[2*i] = (cs >> 24) & 1 ? v01 : v00;
+
+        cs *= cs * 1284865837 + 4150755663;
+        cs += st;
+        b0[2*i+1] = (cs >> 24) & 1 ? v10 : v00;
+
+        b1[2*i+1] = select4(cs, st, v00, v01, v10, v11);
+    }
+}
+
+/* A chain of consecutive zoom layers (such as the river branch) is evaluated
+ * row by row, rather than one layer after the other. Each zoom keeps a ring of
+ * its last four rows, and generates the next pair of rows when the layer above
+ * asks for it, so only the area of the first parent is held as a whole. The
+ * intermediate rows remain in the cache, instead of streaming each zoomed area
+ * through memory.
+ */
+STRUCT(ZoomLevel)
+{
+    const Layer *l;
+    int pX, pZ, pW, pH; // parent area
+    int ox, oz;         // offset of the requested area in the zoomed rows
+    int *rows;          // ring of four zoomed rows (the parent area for [0])
+    int next;           // next pair of rows to generate
+};
+
+/* Returns row 'r' of the area that was requested from level 'm'. */
+static const int *getZoomChainRow(ZoomLevel *lv, int m, int r)
+{
+    if (m == 0)
+        return lv[0].rows + r * lv[1].pW;
+
+    ZoomLevel *zl = &lv[m];
+    int newW = zl->pW << 1;
+    int ar = r + zl->oz;
+
+    while (zl->next <= (ar >> 1))
+    {
+        int j = zl->next++;
+        // the second row of the last pair is never requested
+        const int *p1 = getZoomChainRow(lv, m-1, j+1 < zl->pH ? j+1 : j);
+        const int *p0 = getZoomChainRow(lv, m-1, j);
+        int *b0 = zl->rows + ((2*j) & 3) * newW;
+        int *b1 = zl->rows + ((2*j+1) & 3) * newW;
+        zoomRow(p0, p1, b0, b1, zl->pW, zl->pX, zl->pZ + j,
+                (int)zl->l->startSeed, (int)zl->l->startSalt);
+    }
+
+    return zl->rows + (ar & 3) * newW + zl->ox;
+}
+
+static int mapZoomChain(const Layer * l, int * out, int x, int z, int w, int h)
+{
+    ZoomLevel lv[ZOOM_CHAIN_MAX+1];
+    const Layer *p;
+    int m, n, j;
+
+    // count the zooms, which are numbered from the bottom
+    for (n = 1, p = l; n < ZOOM_CHAIN_MAX && p->p->getMap == mapZoom; n++)
+        p = p->p;
+
+    int pX = x, pZ = z, pW = w, pH = h;
+    for (m = n, p = l; m > 0; m--, p = p->p)
+    {
+        ZoomLevel *zl = &lv[m];
+        zl->l = p;
+        zl->pX = pX >> 1;
+        zl->pZ = pZ >> 1;
+        zl->pW = ((pX + pW) >> 1) - zl->pX + 1;
+        zl->pH = ((pZ + pH) >> 1) - zl->pZ + 1;
+        zl->ox = pX & 1;
+        zl->oz = pZ & 1;
+        zl->next = 0;
+        pX = zl->pX;
+        pZ = zl->pZ;
+        pW = zl->pW;
+        pH = zl->pH;
+    }
+
+    // the output is followed by the area of the first parent and the rings
+    int *buf = out + w * h;
+    int err = getLayerMap(p, buf, pX, pZ, pW, pH);
+    if U(err != 0)
+        return err;
+
+    lv[0].rows = buf;
+    buf += pW * pH + 1; // the zoom reads one cell past the parent area
+    for (m = 1; m <= n; m++)
+    {
+        lv[m].rows = buf;
+        buf += 4 * (lv[m].pW << 1);
+    }
+
+    for (j = 0; j < h; j++)
+    {
+        memcpy(&out[j*w], getZoomChainRow(lv, n, j), w*sizeof(int));
+    }
+
+    return 0;
+}
+
 /// This is the most common layer, and generally the second most performance
 /// critical after mapAddIsland.
 int mapZoom(const Layer * l, int * out, int x, int z, int w, int h)
 {
+    if (l->p->getMap == mapZoom)
+        return mapZoomChain(l, out, x, z, w, h);
+
     int pX = x >> 1;
     int pZ = z >> 1;
     int pW = ((x + w) >> 1) - pX + 1; // (w >> 1) + 2;
     int pH = ((z + h) >> 1) - pZ + 1; // (h >> 1) + 2;
-    int i, j;
+    int j;
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
     int newW = (pW) << 1;
-    int newH = (pH) << 1;
-    int idx, v00, v01, v10, v11;
-    int *buf = (int*) malloc((newW+1)*(newH+1)*sizeof(*buf));
+    int *buf = out + pW * pH; // (newW * newH) of scratch after the parent area
 
     const int st = (int)l->startSalt;
     const int ss = (int)l->startSeed;
 
     for (j = 0; j < pH; j++)
     {
-        idx = (j << 1) * newW;
-
-        v00 = out[(j+0)*pW];
-        v01 = out[(j+1)*pW];
-
-        for (i = 0; i < pW; i++, v00 = v10, v01 = v11)
-        {
-            v10 = out[i+1 + (j+0)*pW];
-            v11 = out[i+1 + (j+1)*pW];
-
-            if (v00 == v01 && v00 == v10 && v00 == v11)
-            {
-                buf[idx] = v00;
-                buf[idx + 1] = v00;
-                buf[idx + newW] = v00;
-                buf[idx + newW + 1] = v00;
-                idx += 2;
-                continue;
-            }
-
-            int chunkX = (i + pX) << 1;
-            int chunkZ = (j + pZ) << 1;
-
-            int cs = ss;
-            cs += chunkX;
-            cs *= cs * 1284865837 + 4150755663;
-            cs += chunkZ;
-            cs *= cs * 1284865837 + 4150755663;
-            cs += chunkX;
-            cs *= cs * 1284865837 + 4150755663;
-            cs += chunkZ;
-
-            buf[idx] = v00;
-            buf[idx + newW] = (cs >> 24) & 1 ? v01 : v00;
-            idx++;
-
-            cs *= cs * 1284865837 + 4150755663;
-            cs += st;
-            buf[idx] = (cs >> 24) & 1 ? v10 : v00;
-
-            buf[idx + newW] = select4(cs, st, v00, v01, v10, v11);
-
-            idx++;
-        }
+        int *b0 = &buf[(j << 1) * newW];
+        zoomRow(&out[(j+0)*pW], &out[(j+1)*pW], b0, b0 + newW, pW, pX, j + pZ, ss, st);
     }
 
+    // rows can overlap with the scratch space for narrow areas
     for (j = 0; j < h; j++)
     {
-        memcpy(&out[j*w], &buf[(j + (z & 1))*newW + (x & 1)], w*sizeof(int));
+        memmove(&out[j*w], &buf[(j + (z & 1))*newW + (x & 1)], w*sizeof(int));
     }
 
-    free(buf);
-
     return 0;
 }
 
@@ -778,7 +960,7 @@ int mapAddIsland(const Layer * l, int * out, int x, int z, int w, int h)
     int pH = h + 2;
     int i, j;
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
@@ -792,12 +974,15 @@ int mapAddIsland(const Layer * l, int * out, int x, int z, int w, int h)
         int *vz1 = out + (j+1)*pW;
         int *vz2 = out + (j+2)*pW;
 
-        int v00 = vz0[0], vt0 = vz0[1];
-        int v02 = vz2[0], vt2 = vz2[1];
+        // vectorized cells first, the scalar loop completes the row
+        i = addIslandRowSimd(vz0, vz1, vz2, out + j*w, w, x, z+j, ss, st);
+
+        int v00 = vz0[i], vt0 = vz0[i+1];
+        int v02 = vz2[i], vt2 = vz2[i+1];
         int v20, v22;
         int v11, v;
 
-        for (i = 0; i < w; i++)
+        for (; i < w; i++)
         {
             v11 = vz1[i+1];
             v20 = vz0[i+2];
@@ -891,7 +1076,7 @@ int mapRemoveTooMuchOcean(const Layer * l, int * out, int x, int z, int w, int h
     int pH = h + 2;
     int i, j;
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
@@ -933,7 +1118,7 @@ int mapAddSnow(const Layer * l, int * out, int x, int z, int w, int h)
     int pH = h + 2;
     int i, j;
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
@@ -977,7 +1162,7 @@ int mapCoolWarm(const Layer * l, int * out, int x, int z, int w, int h)
     int pH = h + 2;
     int i, j;
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
@@ -1016,7 +1201,7 @@ int mapHeatIce(const Layer * l, int * out, int x, int z, int w, int h)
     int pH = h + 2;
     int i, j;
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
@@ -1049,7 +1234,7 @@ int mapHeatIce(const Layer * l, int * out, int x, int z, int w, int h)
 
 int mapSpecial(const Layer * l, int * out, int x, int z, int w, int h)
 {
-    int err = l->p->getMap(l->p, out, x, z, w, h);
+    int err = getLayerMap(l->p, out, x, z, w, h);
     if U(err != 0)
         return err;
 
@@ -1089,7 +1274,7 @@ int mapAddMushroomIsland(const Layer * l, int * out, int x, int z, int w, int h)
     int pH = h + 2;
     int i, j;
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
@@ -1128,13 +1313,17 @@ int mapDeepOcean(const Layer * l, int * out, int x, int z, int w, int h)
     int pH = h + 2;
     int i, j;
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
     for (j = 0; j < h; j++)
     {
-        for (i = 0; i < w; i++)
+        // vectorized cells first, the scalar loop completes the row
+        i = deepOceanRowSimd(out + (j+0)*pW, out + (j+1)*pW, out + (j+2)*pW,
+                out + j*w, w);
+
+        for (; i < w; i++)
         {
             int v11 = out[(i+1) + (j+1)*pW];
 
@@ -1187,7 +1376,7 @@ const int snowBiomes[] = {snowy_tundra, snowy_tundra, snowy_tundra, snowy_taiga}
 
 int mapBiome(const Layer * l, int * out, int x, int z, int w, int h)
 {
-    int err = l->p->getMap(l->p, out, x, z, w, h);
+    int err = getLayerMap(l->p, out, x, z, w, h);
     if U(err != 0)
         return err;
 
@@ -1243,7 +1432,7 @@ const int lushBiomesBE[] = {forest, dark_forest, mountains, plains, plains, plai
 
 int mapBiomeBE(const Layer * l, int * out, int x, int z, int w, int h)
 {
-    int err = l->p->getMap(l->p, out, x, z, w, h);
+    int err = getLayerMap(l->p, out, x, z, w, h);
     if U(err != 0)
         return err;
 
@@ -1297,7 +1486,7 @@ int mapBiomeBE(const Layer * l, int * out, int x, int z, int w, int h)
 
 int mapRiverInit(const Layer * l, int * out, int x, int z, int w, int h)
 {
-    int err = l->p->getMap(l->p, out, x, z, w, h);
+    int err = getLayerMap(l->p, out, x, z, w, h);
     if U(err != 0)
         return err;
 
@@ -1327,7 +1516,7 @@ int mapRiverInit(const Layer * l, int * out, int x, int z, int w, int h)
 
 int mapAddBamboo(const Layer * l, int * out, int x, int z, int w, int h)
 {
-    int err = l->p->getMap(l->p, out, x, z, w, h);
+    int err = getLayerMap(l->p, out, x, z, w, h);
     if U(err != 0)
         return err;
 
@@ -1376,7 +1565,7 @@ int mapBiomeEdge(const Layer * l, int * out, int x, int z, int w, int h)
     int pH = h + 2;
     int i, j;
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
@@ -1386,7 +1575,10 @@ int mapBiomeEdge(const Layer * l, int * out, int x, int z, int w, int h)
         int *vz1 = out + (j+1)*pW;
         int *vz2 = out + (j+2)*pW;
 
-        for (i = 0; i < w; i++)
+        // vectorized cells first, the scalar loop completes the row
+        i = biomeEdgeRowSimd(vz0, vz1, vz2, out + j*w, w);
+
+        for (; i < w; i++)
         {
             int v11 = vz1[i+1];
             int v10 = vz0[i+1];
@@ -1446,7 +1638,6 @@ int mapHills112(const Layer * l, int * out, int x, int z, int w, int h)
     int pW = w + 2;
     int pH = h + 2;
     int i, j;
-    int *buf = NULL;
 
     if U(l->p2 == NULL)
     {
@@ -1454,19 +1645,15 @@ int mapHills112(const Layer * l, int * out, int x, int z, int w, int h)
         exit(1);
     }
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
-    buf = (int *) malloc(pW*pH*sizeof(int));
-    memcpy(buf, out, pW*pH*sizeof(int));
-
-    err = l->p2->getMap(l->p2, out, pX, pZ, pW, pH);
+    // the river noise goes into the scratch space after the biome area
+    int *riv = out + pW * pH;
+    err = getLayerMap(l->p2, riv, pX, pZ, pW, pH);
     if U(err != 0)
-    {
-        free(buf);
         return err;
-    }
 
     int64_t st = l->startSalt;
     int64_t ss = l->startSeed;
@@ -1476,8 +1663,8 @@ int mapHills112(const Layer * l, int * out, int x, int z, int w, int h)
     {
         for (i = 0; i < w; i++)
         {
-            int a11 = buf[i+1 + (j+1)*pW]; // biome branch
-            int b11 = out[i+1 + (j+1)*pW]; // river branch
+            int a11 = out[i+1 + (j+1)*pW]; // biome branch
+            int b11 = riv[i+1 + (j+1)*pW]; // river branch
             int idx = i + j*w;
 
             int bn = (b11 - 2) % 29 == 0;
@@ -1551,10 +1738,10 @@ int mapHills112(const Layer * l, int * out, int x, int z, int w, int h)
                     }
                     else
                     {
-                        int a10 = buf[i+1 + (j+0)*pW];
-                        int a21 = buf[i+2 + (j+1)*pW];
-                        int a01 = buf[i+0 + (j+1)*pW];
-                        int a12 = buf[i+1 + (j+2)*pW];
+                        int a10 = out[i+1 + (j+0)*pW];
+                        int a21 = out[i+2 + (j+1)*pW];
+                        int a01 = out[i+0 + (j+1)*pW];
+                        int a12 = out[i+1 + (j+2)*pW];
                         int equals = 0;
 
                         if (areSimilar112(a10, a11)) equals++;
@@ -1572,7 +1759,6 @@ int mapHills112(const Layer * l, int * out, int x, int z, int w, int h)
         }
     }
 
-    free(buf);
     return 0;
 }
 
@@ -1584,7 +1770,6 @@ int mapHills(const Layer * l, int * out, int x, int z, int w, int h)
     int pW = w + 2;
     int pH = h + 2;
     int i, j;
-    int *buf = NULL;
 
     if U(l->p2 == NULL)
     {
@@ -1592,19 +1777,15 @@ int mapHills(const Layer * l, int * out, int x, int z, int w, int h)
         exit(1);
     }
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
-    buf = (int *) malloc(pW*pH*sizeof(int));
-    memcpy(buf, out, pW*pH*sizeof(int));
-
-    err = l->p2->getMap(l->p2, out, pX, pZ, pW, pH);
+    // the river noise goes into the scratch space after the biome area
+    int *riv = out + pW * pH;
+    err = getLayerMap(l->p2, riv, pX, pZ, pW, pH);
     if U(err != 0)
-    {
-        free(buf);
         return err;
-    }
 
     int64_t st = l->startSalt;
     int64_t ss = l->startSeed;
@@ -1614,8 +1795,8 @@ int mapHills(const Layer * l, int * out, int x, int z, int w, int h)
     {
         for (i = 0; i < w; i++)
         {
-            int a11 = buf[i+1 + (j+1)*pW]; // biome branch
-            int b11 = out[i+1 + (j+1)*pW]; // river branch
+            int a11 = out[i+1 + (j+1)*pW]; // biome branch
+            int b11 = riv[i+1 + (j+1)*pW]; // river branch
             int idx = i + j*w;
 
             int bn = (b11 - 2) % 29;
@@ -1690,10 +1871,10 @@ int mapHills(const Layer * l, int * out, int x, int z, int w, int h)
 
                     if (hillID != a11)
                     {
-                        int a10 = buf[i+1 + (j+0)*pW];
-                        int a21 = buf[i+2 + (j+1)*pW];
-                        int a01 = buf[i+0 + (j+1)*pW];
-                        int a12 = buf[i+1 + (j+2)*pW];
+                        int a10 = out[i+1 + (j+0)*pW];
+                        int a21 = out[i+2 + (j+1)*pW];
+                        int a01 = out[i+0 + (j+1)*pW];
+                        int a12 = out[i+1 + (j+2)*pW];
                         int equals = 0;
 
                         if (areSimilar(a10, a11)) equals++;
@@ -1719,7 +1900,6 @@ int mapHills(const Layer * l, int * out, int x, int z, int w, int h)
         }
     }
 
-    free(buf);
     return 0;
 }
 
@@ -1738,7 +1918,7 @@ int mapRiver(const Layer * l, int * out, int x, int z, int w, int h)
     int pH = h + 2;
     int i, j;
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
@@ -1748,7 +1928,10 @@ int mapRiver(const Layer * l, int * out, int x, int z, int w, int h)
         int *vz1 = out + (j+1)*pW;
         int *vz2 = out + (j+2)*pW;
 
-        for (i = 0; i < w; i++)
+        // vectorized cells first, the scalar loop completes the row
+        i = riverRowSimd(vz0, vz1, vz2, out + j*w, w);
+
+        for (; i < w; i++)
         {
             int v01 = reduceID(vz1[i+0]);
             int v11 = reduceID(vz1[i+1]);
@@ -1779,7 +1962,7 @@ int mapSmooth(const Layer * l, int * out, int x, int z, int w, int h)
     int pH = h + 2;
     int i, j;
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
@@ -1792,7 +1975,10 @@ int mapSmooth(const Layer * l, int * out, int x, int z, int w, int h)
         int *vz1 = out + (j+1)*pW;
         int *vz2 = out + (j+2)*pW;
 
-        for (i = 0; i < w; i++)
+        // vectorized cells first, the scalar loop completes the row
+        i = smoothRowSimd(vz0, vz1, vz2, out + j*w, w, x, z+j, ss);
+
+        for (; i < w; i++)
         {
             int v11 = vz1[i+1];
             int v01 = vz1[i+0];
@@ -1829,7 +2015,7 @@ int mapRareBiome(const Layer * l, int * out, int x, int z, int w, int h)
 {
     int i, j;
 
-    int err = l->p->getMap(l->p, out, x, z, w, h);
+    int err = getLayerMap(l->p, out, x, z, w, h);
     if U(err != 0)
         return err;
 
@@ -1882,7 +2068,7 @@ int mapShore(const Layer * l, int * out, int x, int z, int w, int h)
     int pH = h + 2;
     int i, j;
 
-    int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+    int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
     if U(err != 0)
         return err;
 
@@ -1892,7 +2078,10 @@ int mapShore(const Layer * l, int * out, int x, int z, int w, int h)
         int *vz1 = out + (j+1)*pW;
         int *vz2 = out + (j+2)*pW;
 
-        for (i = 0; i < w; i++)
+        // vectorized cells first, the scalar loop completes the row
+        i = shoreRowSimd(vz0, vz1, vz2, out + j*w, w);
+
+        for (; i < w; i++)
         {
             int v11 = vz1[i+1];
             int v10 = vz0[i+1];
@@ -1968,7 +2157,6 @@ int mapRiverMix(const Layer * l, int * out, int x, int z, int w, int h)
 {
     int idx;
     int len;
-    int *buf;
 
     if U(l->p2 == NULL)
     {
@@ -1977,46 +2165,32 @@ int mapRiverMix(const Layer * l, int * out, int x, int z, int w, int h)
     }
 
 
-    int err = l->p->getMap(l->p, out, x, z, w, h); // biome chain
+    int err = getLayerMap(l->p, out, x, z, w, h); // biome chain
     if U(err != 0)
         return err;
 
     len = w*h;
-    buf = (int *) malloc(len*sizeof(int));
-    memcpy(buf, out, len*sizeof(int));
-
-    err = l->p2->getMap(l->p2, out, x, z, w, h); // rivers
+    int *riv = out + len;
+    err = getLayerMap(l->p2, riv, x, z, w, h); // rivers
     if U(err != 0)
-    {
-        free(buf);
         return err;
-    }
 
     for (idx = 0; idx < len; idx++)
     {
-        if (isOceanic(buf[idx]))
-        {
-            out[idx] = buf[idx];
-        }
-        else
+        if (isOceanic(out[idx]))
+            continue;
+
+        if (riv[idx] == river)
         {
-            if (out[idx] == river)
-            {
-                if (buf[idx] == snowy_tundra)
-                    out[idx] = frozen_river;
-                else if (buf[idx] == mushroom_fields || buf[idx] == mushroom_field_shore)
-                    out[idx] = mushroom_field_shore;
-                else
-                    out[idx] = out[idx] & 255;
-            }
+            if (out[idx] == snowy_tundra)
+                out[idx] = frozen_river;
+            else if (out[idx] == mushroom_fields || out[idx] == mushroom_field_shore)
+                out[idx] = mushroom_field_shore;
             else
-            {
-                out[idx] = buf[idx];
-            }
+                out[idx] = riv[idx] & 255;
         }
     }
 
-    free(buf);
     return 0;
 }
 
@@ -2024,6 +2198,7 @@ int mapRiverMix(const Layer * l, int * out, int x, int z, int w, int h)
 int mapOceanTemp(const Layer * l, int * out, int x, int z, int w, int h)
 {
     int i, j;
+    ensureLayerNoise(l);
     const PerlinNoise *rnd = (const PerlinNoise*) l->noise;
 
     for (j = 0; j < h; j++)
@@ -2061,12 +2236,13 @@ int mapOceanMix(const Layer * l, int * out, int x, int z, int w, int h)
         exit(1);
     }
 
-    int err = l->p2->getMap(l->p2, out, x, z, w, h);
+    // the ocean temperatures are generated in place and the land area goes
+    // into the scratch space after them
+    int err = getLayerMap(l->p2, out, x, z, w, h);
     if U(err != 0)
         return err;
 
-    otyp = (int *) malloc(w*h*sizeof(int));
-    memcpy(otyp, out, w*h*sizeof(int));
+    otyp = out;
 
     // determine the minimum required land area
     lx0 = 0; lx1 = w;
@@ -2092,15 +2268,10 @@ int mapOceanMix(const Layer * l, int * out, int x, int z, int w, int h)
 
     lw = lx1 - lx0;
     lh = lz1 - lz0;
-    err = l->p->getMap(l->p, out, x+lx0, z+lz0, lw, lh);
+    land = out + w*h;
+    err = getLayerMap(l->p, land, x+lx0, z+lz0, lw, lh);
     if U(err != 0)
-    {
-        free(otyp);
         return err;
-    }
-
-    land = (int *) malloc(lw*lh*sizeof(int));
-    memcpy(land, out, lw*lh*sizeof(int));
 
 
     for (j = 0; j < h; j++)
@@ -2163,9 +2334,6 @@ int mapOceanMix(const Layer * l, int * out, int x, int z, int w, int h)
         }
     }
 
-    free(land);
-    free(otyp);
-
     return 0;
 }
 
@@ -2198,13 +2366,13 @@ int mapVoronoiZoom(const Layer * l, int * out, int x, int z, int w, int h)
 
     if (l->p)
     {
-        int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+        int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
         if (err != 0)
             return err;
     }
 
     int64_t sha = l->startSalt;
-    int *buf = (int *) malloc(w*h*sizeof(*buf));
+    int *buf = out + pW * pH; // (w * h) of scratch after the parent area
 
     int x000, x001, x010, x011, x100, x101, x110, x111;
     int y000, y001, y010, y011, y100, y101, y110, y111;
@@ -2265,8 +2433,27 @@ int mapVoronoiZoom(const Layer * l, int * out, int x, int z, int w, int h)
             getVoronoiCell(sha, pix+1, -1, pjz+1, &x110, &y110, &z110);
             getVoronoiCell(sha, pix+1,  0, pjz+1, &x111, &y111, &z111);
 
+            int cx[8] = { x000, x001, x010, x011, x100, x101, x110, x111 };
+            int cy[8] = { y000, y001, y010, y011, y100, y101, y110, y111 };
+            int cz[8] = { z000, z001, z010, z011, z100, z101, z110, z111 };
+            int cv[8] = { v00, v00, v01, v01, v10, v10, v11, v11 };
+            int blk[16];
 
-            for (jj = 0; jj < 4; jj++)
+            if (voronoiBlockSimd(blk, cx, cy, cz, cv))
+            {
+                for (jj = 0; jj < 4; jj++)
+                {
+                    j = j4 + jj;
+                    if (j < 0 || j >= h) continue;
+                    for (ii = 0; ii < 4; ii++)
+                    {
+                        i = i4 + ii;
+                        if (i < 0 || i >= w) continue;
+                        buf[j*w + i] = blk[jj*4 + ii];
+                    }
+                }
+            }
+            else for (jj = 0; jj < 4; jj++)
             {
                 j = j4 + jj;
                 if (j < 0 || j >= h) continue;
@@ -2347,8 +2534,7 @@ int mapVoronoiZoom(const Layer * l, int * out, int x, int z, int w, int h)
         }
     }
 
-    memcpy(out, buf, w*h*sizeof(*buf));
-    free(buf);
+    memmove(out, buf, w*h*sizeof(*buf));
     return 0;
 }
 
@@ -2364,14 +2550,13 @@ int mapVoronoiZoom114(const Layer * l, int * out, int x, int z, int w, int h)
 
     if (l->p)
     {
-        int err = l->p->getMap(l->p, out, pX, pZ, pW, pH);
+        int err = getLayerMap(l->p, out, pX, pZ, pW, pH);
         if (err != 0)
             return err;
     }
 
     int newW = pW << 2;
-    int newH = pH << 2;
-    int *buf = (int *) malloc((newW+1)*(newH+1)*sizeof(*buf));
+    int *buf = out + pW * pH; // (newW * newH) of scratch after the parent area
     int i, j;
 
     int64_t st = l->startSalt;
@@ -2426,6 +2611,11 @@ int mapVoronoiZoom114(const Layer * l, int * out, int x, int z, int w, int h)
             cs = mcStepSeed(cs, st);
             int64_t dd2 = (mcFirstInt(cs, 1024) - 512) * 36 + 40*1024;
 
+            int64_t off[8] = { da1, da2, db1, db2, dc1, dc2, dd1, dd2 };
+            int cv[4] = { v00, v10, v01, v11 };
+            if (voronoi114BlockSimd(pbuf, newW, off, cv))
+                continue;
+
             for (jj = 0; jj < 4; jj++)
             {
                 int mj = 10240*jj;
@@ -2459,16 +2649,61 @@ int mapVoronoiZoom114(const Layer * l, int * out, int x, int z, int w, int h)
         }
     }
 
+    // rows can overlap with the scratch space for narrow areas
     for (j = 0; j < h; j++)
     {
-        memcpy(&out[j * w], &buf[(j + (z & 3))*newW + (x & 3)], w*sizeof(int));
+        memmove(&out[j * w], &buf[(j + (z & 3))*newW + (x & 3)], w*sizeof(int));
     }
 
-    free(buf);
     return 0;
 }
 
 
+/* Stretches the parent by (1 << bits) without any of the random offsets of
+ * the real zooms: every cell takes the biome of the parent cell it lies in.
+ */
+static int mapApproxZoom(const Layer * l, int * out, int x, int z, int w, int h,
+        int bits)
+{
+    int pX = x >> bits;
+    int pZ = z >> bits;
+    int pW = ((x + w - 1) >> bits) - pX + 1;
+    int pH = ((z + h - 1) >> bits) - pZ + 1;
+    int *buf = out + w * h; // (pW * pH) of the parent after the output
+    int i, j;
+
+    int err = getLayerMap(l->p, buf, pX, pZ, pW, pH);
+    if U(err != 0)
+        return err;
+
+    for (j = 0; j < h; j++)
+    {
+        int *row = out + j * w;
+        int pj = ((z + j) >> bits) - pZ;
+        if (j > 0 && pj == ((z + j - 1) >> bits) - pZ)
+        {
+            memcpy(row, row - w, w * sizeof(int));
+            continue;
+        }
+        const int *prow = buf + pj * pW;
+        for (i = 0; i < w; i++)
+            row[i] = prow[((x + i) >> bits) - pX];
+    }
+
+    return 0;
+}
+
+int mapApproxZoom4(const Layer * l, int * out, int x, int z, int w, int h)
+{
+    return mapApproxZoom(l, out, x, z, w, h, 2);
+}
+
+int mapApproxZoom16(const Layer * l, int * out, int x, int z, int w, int h)
+{
+    return mapApproxZoom(l, out, x, z, w, h, 4);
+}
+
+
 inline static __attribute__((always_inline,const))
 uint32_t rotr(uint32_t a, int b) { return (a >> b) | (a << (32-b)); }
 
@@ -176,6 +176,11 @@ STRUCT(Layer)
     int (*getMap)(const Layer *, int *, int, int, int, int);
 
     Layer *p, *p2;      // parent layers
+
+    int64_t worldSeed;  // world seed from setLayerSeed()
+    int noiseState;     // initialisation of the noise for worldSeed (atomic)
+
+    int id;             // index in the generator, or -1 for custom layers
 };
 
 STRUCT(NetherNoise)
@@ -204,9 +209,41 @@ extern Biome biomes[256];
 /* initBiomes() has to be called before any of the generators can be used */
 void initBiomes();
 
-/* Applies the given world seed to the layer and all dependent layers. */
+/* Applies the given world seed to the layer and all dependent layers. The
+ * noise of a layer, which is expensive to initialise, is only initialised
+ * for the seed when the layer is first generated, so a layer that is never
+ * reached does not pay for it.
+ */
 void setLayerSeed(Layer *layer, int64_t worldSeed);
 
+enum
+{
+    LAYER_NOISE_NONE,   // the noise is not initialised for worldSeed
+    LAYER_NOISE_BUSY,   // a thread is initialising the noise
+    LAYER_NOISE_READY,
+};
+
+/* Initialises the noise of a layer for the world seed from setLayerSeed(),
+ * once: concurrent callers wait for the first one. The layers that sample
+ * their noise call this through ensureLayerNoise().
+ */
+void applyLayerNoise(Layer *layer);
+
+static inline void ensureLayerNoise(const Layer *layer)
+{
+#if __GNUC__
+    int state = __atomic_load_n(&layer->noiseState, __ATOMIC_ACQUIRE);
+#else
+    int state = *(const volatile int *) &layer->noiseState; // acquire on MSVC
+#endif
+    if U(state != LAYER_NOISE_READY)
+        applyLayerNoise((Layer *) layer);
+}
+
+/* Derives the seed dependent startSalt and startSeed for a layer salt. */
+void getLayerSeeds(int64_t layerSalt, int64_t worldSeed,
+        int64_t *startSalt, int64_t *startSeed);
+
 
 //==============================================================================
 // Noise
@@ -243,6 +280,15 @@ void setEndSeed(EndNoise *en, int64_t seed);
 int mapEndBiome(const EndNoise *en, int *out, int x, int z, int w, int h);
 int mapEnd(const EndNoise *en, int *out, int x, int z, int w, int h);
 
+/**
+ * Variants of the above that use the caller provided scratch 'buf' instead of
+ * allocating. The required size in bytes is given by getEndScratchSize(),
+ * where 'scale' is 16 for mapEndBiomeBuf() and 4 for mapEndBuf().
+ */
+size_t getEndScratchSize(int scale, int w, int h);
+int mapEndBiomeBuf(const EndNoise *en, int *out, void *buf, int x, int z, int w, int h);
+int mapEndBuf(const EndNoise *en, int *out, void *buf, int x, int z, int w, int h);
+
 //==============================================================================
 // Seed Helpers
 //==============================================================================
@@ -407,6 +453,8 @@ static inline int isBiomeSnowy(int id)
 int mapIsland               (const Layer *, int *, int, int, int, int);
 int mapZoomIsland           (const Layer *, int *, int, int, int, int);
 int mapZoom                 (const Layer *, int *, int, int, int, int);
+// consecutive zooms that mapZoom() evaluates together, row by row
+#define ZOOM_CHAIN_MAX 8
 int mapAddIsland            (const Layer *, int *, int, int, int, int);
 int mapRemoveTooMuchOcean   (const Layer *, int *, int, int, int, int);
 int mapAddSnow              (const Layer *, int *, int, int, int, int);
@@ -434,6 +482,10 @@ int mapOceanMix             (const Layer *, int *, int, int, int, int);
 int mapVoronoiZoom          (const Layer *, int *, int, int, int, int);
 int mapVoronoiZoom114       (const Layer *, int *, int, int, int, int);
 
+// approximate stretches by 4 and 16 of setupApproxGenerator()
+int mapApproxZoom4          (const Layer *, int *, int, int, int, int);
+int mapApproxZoom16         (const Layer *, int *, int, int, int, int);
+
 // With 1.15 voronoi changed in preparation for 3D biome generation.
 // Biome generation now stops at scale 1:4 OceanMix and voronoi is just an
 // access algorithm, mapping the 1:1 scale onto its 1:4 correspondent.
@@ -441,6 +493,16 @@ int mapVoronoiZoom114       (const Layer *, int *, int, int, int, int);
 int64_t getVoronoiSHA(int64_t worldSeed) __attribute__((const));
 void voronoiAccess3D(int64_t sha, int x, int y, int z, int *x4, int *y4, int *z4);
 
+/* Generates an area of a layer with its map function. When the library is
+ * built with CUBIOMES_PROFILE defined, each call is recorded (see profile.h).
+ */
+#ifdef CUBIOMES_PROFILE
+int profileGetMap(const Layer *l, int *out, int x, int z, int w, int h);
+#define getLayerMap(l, out, x, z, w, h) profileGetMap(l, out, x, z, w, h)
+#else
+#define getLayerMap(l, out, x, z, w, h) (l)->getMap(l, out, x, z, w, h)
+#endif
+
 
 #ifdef __cplusplus
 }
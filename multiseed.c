@@ -0,0 +1,933 @@
+#include "multiseed.h"
+#include "layers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define NL MS_LANES
+
+// biome selections of mapBiome
+extern const int warmBiomes[], lushBiomes[], coldBiomes[], snowBiomes[];
+
+
+void setupMultiSeed(MultiSeed *ms, const LayerStack *g, const int64_t *seeds, int n)
+{
+    int k;
+
+    ms->g = g;
+    for (k = 0; k < NL; k++)
+        ms->seeds[k] = seeds[k < n ? k : n-1];
+}
+
+size_t calcRequiredBufMulti(const Layer *layer, int sizeX, int sizeZ)
+{
+    return (size_t) calcRequiredBuf(layer, sizeX, sizeZ) * NL;
+}
+
+int *allocCacheMulti(const Layer *layer, int sizeX, int sizeZ)
+{
+    size_t size = calcRequiredBufMulti(layer, sizeX, sizeZ);
+
+    int *ret = (int *) malloc(sizeof(*ret)*size);
+    if (ret)
+        memset(ret, 0, sizeof(*ret)*size);
+
+    return ret;
+}
+
+
+//==============================================================================
+// Lane Helpers
+//==============================================================================
+
+/* Divisibility tests of the first PRNG integer (cs >> 24) for the moduli of
+ * the hot layers. The integer has 40 bits and since 2^20 = 1 (mod 3) and
+ * (mod 5), it is congruent to the sum of its upper and lower 20 bits. That sum
+ * fits into 32 bits (offset by a multiple of 15 to make it positive), where
+ * divisibility is a multiplication and comparison that vectorizes well.
+ */
+static inline uint32_t foldMod15(int64_t cs)
+{
+    int64_t x = cs >> 24;
+    return (uint32_t)((int32_t)(x >> 20) + (int32_t)(x & 0xfffff) + 15*65536);
+}
+
+static inline int laneIsZero2(int64_t cs) { return ((cs >> 24) & 1) == 0; }
+static inline int laneIsZero4(int64_t cs) { return ((cs >> 24) & 3) == 0; }
+
+static inline int laneIsZero3(int64_t cs)
+{
+    return foldMod15(cs) * 0xAAAAAAABU <= 0x55555555U;
+}
+
+static inline int laneIsZero5(int64_t cs)
+{
+    return foldMod15(cs) * 0xCCCCCCCDU <= 0x33333333U;
+}
+
+static inline uint32_t zoomStep(uint32_t cs, uint32_t salt)
+{
+    return cs * (cs * 1284865837U + 4150755663U) + salt;
+}
+
+#if __GNUC__
+/* With GCC vector extensions, all lanes of a cell are handled as one vector,
+ * which the compiler lowers to the instruction set it targets. Comparisons
+ * produce masks of all bits set, and SEL() blends the lanes with them.
+ */
+typedef int64_t  lane64 __attribute__((vector_size(NL*8)));
+typedef int32_t  lane32 __attribute__((vector_size(NL*4)));
+typedef uint32_t laneu32 __attribute__((vector_size(NL*4)));
+
+#define SEL(M,A,B)      (((M) & (A)) | (~(M) & (B)))
+#define TO64(M)         __builtin_convertvector((M), lane64)
+#define TO32(M)         __builtin_convertvector((M), lane32)
+
+// the mcStepSeed() and getChunkSeed() recurrences for all lanes
+#define V_STEP(S,SALT) \
+    ((S) * ((S) * 6364136223846793005LL + 1442695040888963407LL) + (SALT))
+#define V_CHUNK(CS,SS,X,Z) \
+    do { (CS) = (SS) + (X); (CS) = V_STEP(CS, Z); \
+         (CS) = V_STEP(CS, X); (CS) = V_STEP(CS, Z); } while (0)
+
+// the laneIsZero* tests as masks
+#define V_FOLD15(CS) __builtin_convertvector( \
+    (((CS) >> 24) >> 20) + (((CS) >> 24) & 0xfffff) + 15*65536, laneu32)
+#define V_ISZERO2(CS) TO32((((CS) >> 24) & 1) == 0)
+#define V_ISZERO3(CS) (V_FOLD15(CS) * 0xAAAAAAABU <= 0x55555555U)
+#define V_ISZERO4(CS) TO32((((CS) >> 24) & 3) == 0)
+#define V_ISZERO5(CS) (V_FOLD15(CS) * 0xCCCCCCCDU <= 0x33333333U)
+
+/* The kernels are also compiled for wider instruction sets, chosen at load
+ * time, since 64-bit lane multiplies are slow with the baseline SSE2.
+ */
+#if defined(__x86_64__) && defined(__linux__) && !defined(__clang__)
+#define LANE_TARGETS \
+    __attribute__((target_clones("arch=x86-64-v4", "avx2", "default")))
+#endif
+#endif
+
+#ifndef LANE_TARGETS
+#define LANE_TARGETS
+#endif
+
+#if __GNUC__
+static inline int vAny(const lane32 *m)
+{
+    int k, r = 0;
+    for (k = 0; k < NL; k++)
+        r |= (*m)[k];
+    return r != 0;
+}
+#endif
+
+
+//==============================================================================
+// Lane Layers
+//==============================================================================
+
+static int mapLanes(const MultiSeed *ms, const Layer *l, int *out,
+        int x, int z, int w, int h);
+
+static int layerId(const MultiSeed *ms, const Layer *l)
+{
+    return (int)(l - ms->g->layers);
+}
+
+/* Derives the seeds of a layer for each lane when the layer is generated, so
+ * only the layers that a request reaches are seeded.
+ */
+static void getLaneSeeds(const MultiSeed *ms, const Layer *l,
+        int64_t *startSalt, int64_t *startSeed)
+{
+    int k;
+    for (k = 0; k < NL; k++)
+        getLayerSeeds(l->layerSalt, ms->seeds[k], &startSalt[k], &startSeed[k]);
+}
+
+static int lanesIsland(const MultiSeed *ms, const Layer *l, int *out,
+        int x, int z, int w, int h)
+{
+    int64_t st[NL], ss[NL];
+    getLaneSeeds(ms, l, st, ss);
+    int i, j, k;
+
+    for (j = 0; j < h; j++)
+    {
+        for (i = 0; i < w; i++)
+        {
+            int *o = out + (i + j*w) * NL;
+            for (k = 0; k < NL; k++)
+                o[k] = mcFirstIsZero(getChunkSeed(ss[k], i + x, j + z), 10);
+        }
+    }
+
+    if (x > -w && x <= 0 && z > -h && z <= 0)
+    {
+        int *o = out + (-x + -z * w) * NL;
+        for (k = 0; k < NL; k++)
+            o[k] = 1;
+    }
+
+    return 0;
+}
+
+/* Generates the 2x2 cells (b0[0..1], b1[0..1]) of a zoom from the parent
+ * cells v00, v10 (top) and v01, v11 (bottom) for all the lanes.
+ */
+static inline void zoomCell(const int *v00, const int *v01, const int *v10,
+        const int *v11, int *b0, int *b1, const uint32_t *ss,
+        const uint32_t *st, uint32_t chunkX, uint32_t chunkZ, int island)
+{
+#if __GNUC__
+    lane32 a, b, c, d;
+    memcpy(&a, v00, sizeof(a));
+    memcpy(&b, v01, sizeof(b));
+    memcpy(&c, v10, sizeof(c));
+    memcpy(&d, v11, sizeof(d));
+
+    lane32 diff = (a != b) | (a != c) | (a != d);
+    if (!vAny(&diff))
+    {
+        memcpy(b0, &a, sizeof(a));
+        memcpy(b0 + NL, &a, sizeof(a));
+        memcpy(b1, &a, sizeof(a));
+        memcpy(b1 + NL, &a, sizeof(a));
+        return;
+    }
+
+    laneu32 vss, vst;
+    memcpy(&vss, ss, sizeof(vss));
+    memcpy(&vst, st, sizeof(vst));
+
+    laneu32 cs = vss + chunkX;
+    cs = cs * (cs * 1284865837U + 4150755663U) + chunkZ;
+    cs = cs * (cs * 1284865837U + 4150755663U) + chunkX;
+    cs = cs * (cs * 1284865837U + 4150755663U) + chunkZ;
+
+    lane32 r0 = a;
+    lane32 r2 = SEL(-(lane32)((cs >> 24) & 1), b, a);
+    cs = cs * (cs * 1284865837U + 4150755663U) + vst;
+    lane32 r1 = SEL(-(lane32)((cs >> 24) & 1), c, a);
+    laneu32 cr = cs * (cs * 1284865837U + 4150755663U) + vst;
+    lane32 r = (lane32)((cr >> 24) & 3);
+    lane32 rv = SEL(r == 0, a, SEL(r == 1, c, SEL(r == 2, b, d)));
+    lane32 r3 = rv;
+    if (!island)
+    {
+        // select4() from mapZoom, the masks count negatively
+        lane32 cv00 = (a == c) + (a == b) + (a == d);
+        lane32 cv10 = (c == b) + (c == d);
+        lane32 cv01 = (b == d);
+        r3 = SEL((cv00 < cv10) & (cv00 < cv01), a,
+             SEL(cv10 < cv00, c,
+             SEL(cv01 < cv00, b, rv)));
+    }
+
+    memcpy(b0, &r0, sizeof(r0));
+    memcpy(b0 + NL, &r1, sizeof(r1));
+    memcpy(b1, &r2, sizeof(r2));
+    memcpy(b1 + NL, &r3, sizeof(r3));
+#else
+    int k;
+    int same = 1;
+    for (k = 0; k < NL; k++)
+        same &= (v00[k] == v10[k]) & (v00[k] == v01[k]) & (v00[k] == v11[k]);
+    if (same)
+    {
+        memcpy(b0, v00, NL * sizeof(int));
+        memcpy(b0 + NL, v00, NL * sizeof(int));
+        memcpy(b1, v00, NL * sizeof(int));
+        memcpy(b1 + NL, v00, NL * sizeof(int));
+        return;
+    }
+
+    for (k = 0; k < NL; k++)
+    {
+        int a = v00[k], b = v01[k], c = v10[k], d = v11[k];
+        uint32_t cs = ss[k] + chunkX;
+        cs = zoomStep(cs, chunkZ);
+        cs = zoomStep(cs, chunkX);
+        cs = zoomStep(cs, chunkZ);
+
+        b0[k] = a;
+        b1[k] = (cs >> 24) & 1 ? b : a;
+
+        cs = zoomStep(cs, st[k]);
+        b0[NL+k] = (cs >> 24) & 1 ? c : a;
+
+        uint32_t r = (zoomStep(cs, st[k]) >> 24) & 3;
+        int rv = r==0 ? a : r==1 ? c : r==2 ? b : d;
+        if (island)
+        {
+            b1[NL+k] = rv;
+        }
+        else
+        {
+            // select4() from mapZoom
+            int cv00 = (a == c) + (a == b) + (a == d);
+            int cv10 = (c == b) + (c == d);
+            int cv01 = (b == d);
+            b1[NL+k] =
+                (cv00 > cv10 && cv00 > cv01) ? a :
+                (cv10 > cv00) ? c :
+                (cv01 > cv00) ? b : rv;
+        }
+    }
+#endif
+}
+
+LANE_TARGETS
+static int lanesZoom(const MultiSeed *ms, const Layer *l, int *out,
+        int x, int z, int w, int h, int island)
+{
+    int pX = x >> 1;
+    int pZ = z >> 1;
+    int pW = ((x + w) >> 1) - pX + 1;
+    int pH = ((z + h) >> 1) - pZ + 1;
+    int i, j, k;
+
+    int err = mapLanes(ms, l->p, out, pX, pZ, pW, pH);
+    if U(err != 0)
+        return err;
+
+    int64_t st64[NL], ss64[NL];
+    getLaneSeeds(ms, l, st64, ss64);
+    uint32_t st[NL], ss[NL];
+    for (k = 0; k < NL; k++)
+    {
+        st[k] = (uint32_t) st64[k];
+        ss[k] = (uint32_t) ss64[k];
+    }
+
+    int newW = pW << 1;
+    int *buf = out + pW * pH * NL; // (newW * newH) cells of scratch
+
+    for (j = 0; j < pH; j++)
+    {
+        for (i = 0; i < pW; i++)
+        {
+            const int *v00 = out + ((j+0)*pW + i+0) * NL;
+            const int *v10 = out + ((j+0)*pW + i+1) * NL;
+            const int *v01 = out + ((j+1)*pW + i+0) * NL;
+            const int *v11 = out + ((j+1)*pW + i+1) * NL;
+            int *b0 = buf + ((2*j+0)*newW + 2*i) * NL;
+            int *b1 = buf + ((2*j+1)*newW + 2*i) * NL;
+
+            zoomCell(v00, v01, v10, v11, b0, b1, ss, st,
+                    (uint32_t)(i + pX) << 1, (uint32_t)(j + pZ) << 1, island);
+        }
+    }
+
+    // rows can overlap with the scratch space for narrow areas
+    for (j = 0; j < h; j++)
+    {
+        memmove(&out[j*w*NL], &buf[((j + (z & 1))*newW + (x & 1)) * NL],
+                w*NL*sizeof(int));
+    }
+
+    return 0;
+}
+
+LANE_TARGETS
+static int lanesAddIsland(const MultiSeed *ms, const Layer *l, int *out,
+        int x, int z, int w, int h)
+{
+    int pX = x - 1;
+    int pZ = z - 1;
+    int pW = w + 2;
+    int pH = h + 2;
+    int i, j;
+#if !__GNUC__
+    int k;
+#endif
+
+    int err = mapLanes(ms, l->p, out, pX, pZ, pW, pH);
+    if U(err != 0)
+        return err;
+
+    int64_t st[NL], ss[NL];
+    getLaneSeeds(ms, l, st, ss);
+
+    for (j = 0; j < h; j++)
+    {
+        for (i = 0; i < w; i++)
+        {
+            const int *p00 = out + ((j+0)*pW + i+0) * NL;
+            const int *p20 = out + ((j+0)*pW + i+2) * NL;
+            const int *p02 = out + ((j+2)*pW + i+0) * NL;
+            const int *p22 = out + ((j+2)*pW + i+2) * NL;
+            const int *p11 = out + ((j+1)*pW + i+1) * NL;
+#if __GNUC__
+            lane32 v00, v20, v02, v22, v11;
+            memcpy(&v00, p00, sizeof(v00));
+            memcpy(&v20, p20, sizeof(v20));
+            memcpy(&v02, p02, sizeof(v02));
+            memcpy(&v22, p22, sizeof(v22));
+            memcpy(&v11, p11, sizeof(v11));
+
+            lane32 n00 = v00 != 0, n20 = v20 != 0;
+            lane32 n02 = v02 != 0, n22 = v22 != 0;
+            lane32 all = n00 & n20 & n02 & n22;
+
+            // skip the PRNG when no lane borders a coast
+            lane32 coast = SEL(v11 == 0, (v00 | v20 | v02 | v22) != 0,
+                    (v11 != 4) & ~all);
+            if (!vAny(&coast))
+            {
+                memmove(out + (i + j*w) * NL, p11, NL * sizeof(int));
+                continue;
+            }
+
+            lane64 vss, vst;
+            memcpy(&vss, ss, sizeof(vss));
+            memcpy(&vst, st, sizeof(vst));
+            lane64 cs0, cs;
+            V_CHUNK(cs0, vss, i+x, j+z);
+            cs = cs0;
+            lane32 inc, take, v;
+
+            // ocean cell: replicates the stepping of mapAddIsland, with the
+            // masks counting the land neighbours negatively
+            inc = n00;
+            v = SEL(n00, v00, 1);
+            cs = SEL(TO64(n00), V_STEP(cs, vst), cs);
+
+            inc += n20;
+            take = n20 & ((inc == -1) | V_ISZERO2(cs));
+            v = SEL(take, v20, v);
+            cs = SEL(TO64(n20), V_STEP(cs, vst), cs);
+
+            inc += n02;
+            take = n02 & ((inc == -1) | ((inc == -2) & V_ISZERO2(cs)) |
+                ((inc == -3) & V_ISZERO3(cs)));
+            v = SEL(take, v02, v);
+            cs = SEL(TO64(n02), V_STEP(cs, vst), cs);
+
+            inc += n22;
+            take = n22 & ((inc == -1) | ((inc == -2) & V_ISZERO2(cs)) |
+                ((inc == -3) & V_ISZERO3(cs)) | ((inc == -4) & V_ISZERO4(cs)));
+            v = SEL(take, v22, v);
+            cs = SEL(TO64(n22), V_STEP(cs, vst), cs);
+
+            lane32 land = SEL((inc < 0) & ((v == 4) | V_ISZERO3(cs)), v, 0);
+
+            // land cell: becomes ocean next to an ocean diagonal
+            lane32 shore = ~all & V_ISZERO5(cs0);
+
+            lane32 res = SEL(v11 == 0, land, SEL(v11 == 4, 4, SEL(shore, 0, v11)));
+#else
+            int res[NL];
+
+            // skip the PRNG when no lane borders a coast
+            int coast = 0;
+            for (k = 0; k < NL; k++)
+            {
+                int any = p00[k] | p20[k] | p02[k] | p22[k];
+                int all = (p00[k] != 0) & (p20[k] != 0) & (p02[k] != 0) & (p22[k] != 0);
+                int v11 = p11[k];
+                coast |= (v11 == 0) ? any != 0 : (v11 != 4) & !all;
+            }
+            if (!coast)
+            {
+                memmove(out + (i + j*w) * NL, p11, NL * sizeof(int));
+                continue;
+            }
+
+            for (k = 0; k < NL; k++)
+            {
+                int v00 = p00[k], v20 = p20[k], v02 = p02[k], v22 = p22[k];
+                int v11 = p11[k];
+                int64_t cs0 = getChunkSeed(ss[k], i+x, j+z);
+                int64_t cs = cs0;
+                int n00 = v00 != 0, n20 = v20 != 0;
+                int n02 = v02 != 0, n22 = v22 != 0;
+                int inc, take, v;
+
+                // ocean cell: replicates the stepping of mapAddIsland
+                // (using bitwise logic to keep the lanes free of branches)
+                inc = n00;
+                v = n00 ? v00 : 1;
+                cs = n00 ? mcStepSeed(cs, st[k]) : cs;
+
+                inc += n20;
+                take = n20 & ((inc == 1) | laneIsZero2(cs));
+                v = take ? v20 : v;
+                cs = n20 ? mcStepSeed(cs, st[k]) : cs;
+
+                inc += n02;
+                take = n02 & ((inc == 1) | ((inc == 2) & laneIsZero2(cs)) |
+                    ((inc == 3) & laneIsZero3(cs)));
+                v = take ? v02 : v;
+                cs = n02 ? mcStepSeed(cs, st[k]) : cs;
+
+                inc += n22;
+                take = n22 & ((inc == 1) | ((inc == 2) & laneIsZero2(cs)) |
+                    ((inc == 3) & laneIsZero3(cs)) | ((inc == 4) & laneIsZero4(cs)));
+                v = take ? v22 : v;
+                cs = n22 ? mcStepSeed(cs, st[k]) : cs;
+
+                int land = ((inc > 0) & ((v == 4) | laneIsZero3(cs))) ? v : 0;
+
+                // land cell: becomes ocean next to an ocean diagonal
+                int shore = ((n00 & n20 & n02 & n22) == 0) & laneIsZero5(cs0);
+
+                res[k] = v11 == 0 ? land : v11 == 4 ? 4 : shore ? 0 : v11;
+            }
+
+#endif
+
+            // results are stored in place, as in mapAddIsland, after all the
+            // lanes have read their neighbours
+            memcpy(out + (i + j*w) * NL, &res, sizeof(res));
+        }
+    }
+
+    return 0;
+}
+
+static int lanesRemoveTooMuchOcean(const MultiSeed *ms, const Layer *l,
+        int *out, int x, int z, int w, int h)
+{
+    int pX = x - 1;
+    int pZ = z - 1;
+    int pW = w + 2;
+    int pH = h + 2;
+    int i, j, k;
+
+    int err = mapLanes(ms, l->p, out, pX, pZ, pW, pH);
+    if U(err != 0)
+        return err;
+
+    int64_t st[NL], ss[NL];
+    getLaneSeeds(ms, l, st, ss);
+
+    for (j = 0; j < h; j++)
+    {
+        for (i = 0; i < w; i++)
+        {
+            const int *p10 = out + ((j+0)*pW + i+1) * NL;
+            const int *p21 = out + ((j+1)*pW + i+2) * NL;
+            const int *p01 = out + ((j+1)*pW + i+0) * NL;
+            const int *p12 = out + ((j+2)*pW + i+1) * NL;
+            const int *p11 = out + ((j+1)*pW + i+1) * NL;
+            int res[NL];
+
+            for (k = 0; k < NL; k++)
+            {
+                int v11 = p11[k];
+                int isle = !(p10[k] | p21[k] | p01[k] | p12[k] | v11) &&
+                    laneIsZero2(getChunkSeed(ss[k], i+x, j+z));
+                res[k] = isle ? 1 : v11;
+            }
+            memcpy(out + (i + j*w) * NL, &res, sizeof(res));
+        }
+    }
+
+    return 0;
+}
+
+static int lanesAddSnow(const MultiSeed *ms, const Layer *l, int *out,
+        int x, int z, int w, int h)
+{
+    int pX = x - 1;
+    int pZ = z - 1;
+    int pW = w + 2;
+    int pH = h + 2;
+    int i, j, k;
+
+    int err = mapLanes(ms, l->p, out, pX, pZ, pW, pH);
+    if U(err != 0)
+        return err;
+
+    int64_t st[NL], ss[NL];
+    getLaneSeeds(ms, l, st, ss);
+
+    for (j = 0; j < h; j++)
+    {
+        for (i = 0; i < w; i++)
+        {
+            const int *p11 = out + ((j+1)*pW + i+1) * NL;
+            int res[NL];
+
+            for (k = 0; k < NL; k++)
+            {
+                int v11 = p11[k];
+                if (isShallowOcean(v11))
+                {
+                    res[k] = v11;
+                }
+                else
+                {
+                    int r = mcFirstInt(getChunkSeed(ss[k], i+x, j+z), 6);
+                    res[k] = r == 0 ? 4 : r <= 1 ? 3 : 1;
+                }
+            }
+            memcpy(out + (i + j*w) * NL, &res, sizeof(res));
+        }
+    }
+
+    return 0;
+}
+
+/* mapCoolWarm and mapHeatIce: replace a climate next to two others. */
+static int lanesClimate(const MultiSeed *ms, const Layer *l, int *out,
+        int x, int z, int w, int h, int from, int near0, int near1, int to)
+{
+    int pX = x - 1;
+    int pZ = z - 1;
+    int pW = w + 2;
+    int pH = h + 2;
+    int i, j, k;
+
+    int err = mapLanes(ms, l->p, out, pX, pZ, pW, pH);
+    if U(err != 0)
+        return err;
+
+    for (j = 0; j < h; j++)
+    {
+        for (i = 0; i < w; i++)
+        {
+            const int *p10 = out + ((j+0)*pW + i+1) * NL;
+            const int *p21 = out + ((j+1)*pW + i+2) * NL;
+            const int *p01 = out + ((j+1)*pW + i+0) * NL;
+            const int *p12 = out + ((j+2)*pW + i+1) * NL;
+            const int *p11 = out + ((j+1)*pW + i+1) * NL;
+            int res[NL];
+
+            for (k = 0; k < NL; k++)
+            {
+                int v10 = p10[k], v21 = p21[k], v01 = p01[k], v12 = p12[k];
+                int near =
+                    v10 == near0 || v10 == near1 || v21 == near0 || v21 == near1 ||
+                    v01 == near0 || v01 == near1 || v12 == near0 || v12 == near1;
+                res[k] = (p11[k] == from && near) ? to : p11[k];
+            }
+            memcpy(out + (i + j*w) * NL, &res, sizeof(res));
+        }
+    }
+
+    return 0;
+}
+
+static int lanesSpecial(const MultiSeed *ms, const Layer *l, int *out,
+        int x, int z, int w, int h)
+{
+    int err = mapLanes(ms, l->p, out, x, z, w, h);
+    if U(err != 0)
+        return err;
+
+    int64_t st[NL], ss[NL];
+    getLaneSeeds(ms, l, st, ss);
+    int i, j, k;
+
+    for (j = 0; j < h; j++)
+    {
+        for (i = 0; i < w; i++)
+        {
+            int *o = out + (i + j*w) * NL;
+            for (k = 0; k < NL; k++)
+            {
+                int v = o[k];
+                if (v == 0)
+                    continue;
+
+                int64_t cs = getChunkSeed(ss[k], i+x, j+z);
+                if (mcFirstIsZero(cs, 13))
+                {
+                    cs = mcStepSeed(cs, st[k]);
+                    o[k] = v | ((1 + mcFirstInt(cs, 15)) << 8 & 0xf00);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int lanesAddMushroomIsland(const MultiSeed *ms, const Layer *l,
+        int *out, int x, int z, int w, int h)
+{
+    int pX = x - 1;
+    int pZ = z - 1;
+    int pW = w + 2;
+    int pH = h + 2;
+    int i, j, k;
+
+    int err = mapLanes(ms, l->p, out, pX, pZ, pW, pH);
+    if U(err != 0)
+        return err;
+
+    int64_t st[NL], ss[NL];
+    getLaneSeeds(ms, l, st, ss);
+
+    for (j = 0; j < h; j++)
+    {
+        for (i = 0; i < w; i++)
+        {
+            const int *p00 = out + ((j+0)*pW + i+0) * NL;
+            const int *p20 = out + ((j+0)*pW + i+2) * NL;
+            const int *p02 = out + ((j+2)*pW + i+0) * NL;
+            const int *p22 = out + ((j+2)*pW + i+2) * NL;
+            const int *p11 = out + ((j+1)*pW + i+1) * NL;
+            int res[NL];
+
+            for (k = 0; k < NL; k++)
+            {
+                int v11 = p11[k];
+                if (v11 == 0 && !(p00[k] | p20[k] | p02[k] | p22[k]) &&
+                    mcFirstIsZero(getChunkSeed(ss[k], i+x, j+z), 100))
+                {
+                    v11 = mushroom_fields;
+                }
+                res[k] = v11;
+            }
+            memcpy(out + (i + j*w) * NL, &res, sizeof(res));
+        }
+    }
+
+    return 0;
+}
+
+static int lanesDeepOcean(const MultiSeed *ms, const Layer *l, int *out,
+        int x, int z, int w, int h)
+{
+    int pX = x - 1;
+    int pZ = z - 1;
+    int pW = w + 2;
+    int pH = h + 2;
+    int i, j, k;
+
+    int err = mapLanes(ms, l->p, out, pX, pZ, pW, pH);
+    if U(err != 0)
+        return err;
+
+    for (j = 0; j < h; j++)
+    {
+        for (i = 0; i < w; i++)
+        {
+            const int *p10 = out + ((j+0)*pW + i+1) * NL;
+            const int *p21 = out + ((j+1)*pW + i+2) * NL;
+            const int *p01 = out + ((j+1)*pW + i+0) * NL;
+            const int *p12 = out + ((j+2)*pW + i+1) * NL;
+            const int *p11 = out + ((j+1)*pW + i+1) * NL;
+            int res[NL];
+
+            for (k = 0; k < NL; k++)
+            {
+                int v11 = p11[k];
+                if (isShallowOcean(v11) &&
+                    isShallowOcean(p10[k]) && isShallowOcean(p21[k]) &&
+                    isShallowOcean(p01[k]) && isShallowOcean(p12[k]))
+                {
+                    switch (v11)
+                    {
+                    case warm_ocean:        v11 = deep_warm_ocean; break;
+                    case lukewarm_ocean:    v11 = deep_lukewarm_ocean; break;
+                    case cold_ocean:        v11 = deep_cold_ocean; break;
+                    case frozen_ocean:      v11 = deep_frozen_ocean; break;
+                    default:                v11 = deep_ocean;
+                    }
+                }
+                res[k] = v11;
+            }
+            memcpy(out + (i + j*w) * NL, &res, sizeof(res));
+        }
+    }
+
+    return 0;
+}
+
+static int lanesBiome(const MultiSeed *ms, const Layer *l, int *out,
+        int x, int z, int w, int h)
+{
+    int err = mapLanes(ms, l->p, out, x, z, w, h);
+    if U(err != 0)
+        return err;
+
+    int64_t st[NL], ss[NL];
+    getLaneSeeds(ms, l, st, ss);
+    int i, j, k;
+
+    for (j = 0; j < h; j++)
+    {
+        for (i = 0; i < w; i++)
+        {
+            int *o = out + (i + j*w) * NL;
+            for (k = 0; k < NL; k++)
+            {
+                int id = o[k];
+                int hasHighBit = (id & 0xf00);
+                id &= ~0xf00;
+
+                if (getBiomeType(id) == Ocean || id == mushroom_fields)
+                {
+                    o[k] = id;
+                    continue;
+                }
+
+                int64_t cs = getChunkSeed(ss[k], i + x, j + z);
+
+                switch (id)
+                {
+                case Warm:
+                    if (hasHighBit) o[k] = mcFirstIsZero(cs, 3) ? badlands_plateau : wooded_badlands_plateau;
+                    else o[k] = warmBiomes[mcFirstInt(cs, 6)];
+                    break;
+                case Lush:
+                    if (hasHighBit) o[k] = jungle;
+                    else o[k] = lushBiomes[mcFirstInt(cs, 6)];
+                    break;
+                case Cold:
+                    if (hasHighBit) o[k] = giant_tree_taiga;
+                    else o[k] = coldBiomes[mcFirstInt(cs, 4)];
+                    break;
+                case Freezing:
+                    o[k] = snowBiomes[mcFirstInt(cs, 4)];
+                    break;
+                default:
+                    o[k] = mushroom_fields;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int lanesAddBamboo(const MultiSeed *ms, const Layer *l, int *out,
+        int x, int z, int w, int h)
+{
+    int err = mapLanes(ms, l->p, out, x, z, w, h);
+    if U(err != 0)
+        return err;
+
+    int64_t st[NL], ss[NL];
+    getLaneSeeds(ms, l, st, ss);
+    int i, j, k;
+
+    for (j = 0; j < h; j++)
+    {
+        for (i = 0; i < w; i++)
+        {
+            int *o = out + (i + j*w) * NL;
+            for (k = 0; k < NL; k++)
+            {
+                if (o[k] == jungle &&
+                    mcFirstIsZero(getChunkSeed(ss[k], i + x, j + z), 10))
+                {
+                    o[k] = bamboo_jungle;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int lanesRiverInit(const MultiSeed *ms, const Layer *l, int *out,
+        int x, int z, int w, int h)
+{
+    int err = mapLanes(ms, l->p, out, x, z, w, h);
+    if U(err != 0)
+        return err;
+
+    int64_t st[NL], ss[NL];
+    getLaneSeeds(ms, l, st, ss);
+    int i, j, k;
+
+    for (j = 0; j < h; j++)
+    {
+        for (i = 0; i < w; i++)
+        {
+            int *o = out + (i + j*w) * NL;
+            for (k = 0; k < NL; k++)
+            {
+                if (o[k] > 0)
+                    o[k] = mcFirstInt(getChunkSeed(ss[k], i + x, j + z), 299999)+2;
+                else
+                    o[k] = 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Generates an area for one seed at a time, for layers without a seed-parallel
+ * implementation. This runs on a layer context of its own.
+ */
+static int lanesFallback(const MultiSeed *ms, const Layer *l, int *out,
+        int x, int z, int w, int h)
+{
+    const LayerStack *g = ms->g;
+    LayerContext *ctx = (LayerContext *) malloc(sizeof(LayerContext));
+    int *buf = allocCache(l, w, h);
+    int i, k, err = 0;
+
+    if U(ctx == NULL || buf == NULL)
+    {
+        free(buf);
+        free(ctx);
+        return -1;
+    }
+
+    initLayerContext(ctx, g);
+    Layer *cl = ctx->stack.layers + layerId(ms, l);
+    for (k = 0; k < NL && err == 0; k++)
+    {
+        setLayerSeed(cl, ms->seeds[k]);
+        err = getLayerMap(cl, buf, x, z, w, h);
+        for (i = 0; i < w*h; i++)
+            out[i*NL + k] = buf[i];
+    }
+
+    free(buf);
+    free(ctx);
+    return err;
+}
+
+static int mapLanes(const MultiSeed *ms, const Layer *l, int *out,
+        int x, int z, int w, int h)
+{
+    mapfunc_t map = l->getMap;
+
+    if (map == mapIsland)
+        return lanesIsland(ms, l, out, x, z, w, h);
+    if (map == mapZoomIsland)
+        return lanesZoom(ms, l, out, x, z, w, h, 1);
+    if (map == mapZoom)
+        return lanesZoom(ms, l, out, x, z, w, h, 0);
+    if (map == mapAddIsland)
+        return lanesAddIsland(ms, l, out, x, z, w, h);
+    if (map == mapRemoveTooMuchOcean)
+        return lanesRemoveTooMuchOcean(ms, l, out, x, z, w, h);
+    if (map == mapAddSnow)
+        return lanesAddSnow(ms, l, out, x, z, w, h);
+    if (map == mapCoolWarm)
+        return lanesClimate(ms, l, out, x, z, w, h, 1, 3, 4, 2);
+    if (map == mapHeatIce)
+        return lanesClimate(ms, l, out, x, z, w, h, 4, 1, 2, 3);
+    if (map == mapSpecial)
+        return lanesSpecial(ms, l, out, x, z, w, h);
+    if (map == mapAddMushroomIsland)
+        return lanesAddMushroomIsland(ms, l, out, x, z, w, h);
+    if (map == mapDeepOcean)
+        return lanesDeepOcean(ms, l, out, x, z, w, h);
+    if (map == mapBiome)
+        return lanesBiome(ms, l, out, x, z, w, h);
+    if (map == mapAddBamboo)
+        return lanesAddBamboo(ms, l, out, x, z, w, h);
+    if (map == mapRiverInit)
+        return lanesRiverInit(ms, l, out, x, z, w, h);
+
+    return lanesFallback(ms, l, out, x, z, w, h);
+}
+
+int genAreaMulti(const MultiSeed *ms, const Layer *layer, int *out,
+        int areaX, int areaZ, int areaWidth, int areaHeight)
+{
+    return mapLanes(ms, layer, out, areaX, areaZ, areaWidth, areaHeight);
+}
@@ -0,0 +1,60 @@
+#ifndef MULTISEED_H_
+#define MULTISEED_H_
+
+#include "generator.h"
+
+/* Seed-parallel generation evaluates the same area for several world seeds in
+ * one pass. The layer rules are the same for every seed and only the PRNG
+ * state differs, so the cells of all seeds are stored side by side (one lane
+ * per seed) and each layer processes the lanes together as vectors (with GCC)
+ * or in loops that the compiler can vectorize.
+ *
+ * The generated biomes are indexed in the form:
+ *     out[(x + z*areaWidth) * MS_LANES + lane]
+ *
+ * Layers of the main biome chain down to L_BIOME_256 (and L14_BAMBOO_256),
+ * as well as the zoom layers and the river initialisation, are evaluated
+ * across the lanes. Other layers are generated for one seed at a time, which
+ * gives the same result, just without the speedup.
+ */
+
+/* Number of world seeds that are evaluated together. */
+#define MS_LANES 8
+
+STRUCT(MultiSeed)
+{
+    const LayerStack *g;                // generator providing the layer graph
+    int64_t seeds[MS_LANES];            // the layer seeds derive from these
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Sets up seed-parallel generation for 'n' (at most MS_LANES) world seeds with
+ * the layers of 'g'. Unused lanes repeat the last seed. The seeds applied to
+ * 'g' itself do not matter and 'g' is not modified.
+ */
+void setupMultiSeed(MultiSeed *ms, const LayerStack *g, const int64_t *seeds, int n);
+
+/* Calculates the number of ints required for a seed-parallel buffer to
+ * generate an area of dimensions 'sizeX' by 'sizeZ' at the specified layer.
+ */
+size_t calcRequiredBufMulti(const Layer *layer, int sizeX, int sizeZ);
+
+/* Allocates a buffer for seed-parallel generation at the given layer. */
+int *allocCacheMulti(const Layer *layer, int sizeX, int sizeZ);
+
+/* Generates the specified area at the given layer of the generator for all
+ * the seeds at once. The 'layer' has to be one of the layers of ms->g.
+ * Returns non-zero if the generation failed.
+ */
+int genAreaMulti(const MultiSeed *ms, const Layer *layer, int *out,
+        int areaX, int areaZ, int areaWidth, int areaHeight);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MULTISEED_H_ */
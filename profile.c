@@ -0,0 +1,325 @@
+#include "profile.h"
+#include "layers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define THREAD_LOCAL __declspec(thread)
+#else
+#include <time.h>
+#define THREAD_LOCAL __thread
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <x86intrin.h>
+#endif
+
+
+// names of the layer indices in the order of the enum in generator.h
+static const char *layerNames[] =
+{
+    "L_ISLAND_4096",
+    "L_ZOOM_2048",
+    "L_ADD_ISLAND_2048",
+    "L_ZOOM_1024",
+    "L_ADD_ISLAND_1024A",
+    "L_ADD_ISLAND_1024B",
+    "L_ADD_ISLAND_1024C",
+    "L_REMOVE_OCEAN_1024",
+    "L_ADD_SNOW_1024",
+    "L_ADD_ISLAND_1024D",
+    "L_COOL_WARM_1024",
+    "L_HEAT_ICE_1024",
+    "L_SPECIAL_1024",
+    "L_ZOOM_512",
+    "L_ZOOM_256",
+    "L_ADD_ISLAND_256",
+    "L_ADD_MUSHROOM_256",
+    "L_DEEP_OCEAN_256",
+    "L_BIOME_256",
+    "L_ZOOM_128",
+    "L_ZOOM_64",
+    "L_BIOME_EDGE_64",
+    "L_RIVER_INIT_256",
+    "L_ZOOM_128_HILLS",
+    "L_ZOOM_64_HILLS",
+    "L_HILLS_64",
+    "L_RARE_BIOME_64",
+    "L_ZOOM_32",
+    "L_ADD_ISLAND_32",
+    "L_ZOOM_16",
+    "L_SHORE_16",
+    "L_ZOOM_8",
+    "L_ZOOM_4",
+    "L_SMOOTH_4",
+    "L_ZOOM_128_RIVER",
+    "L_ZOOM_64_RIVER",
+    "L_ZOOM_32_RIVER",
+    "L_ZOOM_16_RIVER",
+    "L_ZOOM_8_RIVER",
+    "L_ZOOM_4_RIVER",
+    "L_RIVER_4",
+    "L_SMOOTH_4_RIVER",
+    "L_RIVER_MIX_4",
+    "L_VORONOI_ZOOM_1",
+    "L13_OCEAN_TEMP_256",
+    "L13_ZOOM_128",
+    "L13_ZOOM_64",
+    "L13_ZOOM_32",
+    "L13_ZOOM_16",
+    "L13_ZOOM_8",
+    "L13_ZOOM_4",
+    "L13_OCEAN_MIX_4",
+    "L14_BAMBOO_256",
+    "L_ZOOM_LARGE_BIOME_A",
+    "L_ZOOM_LARGE_BIOME_B",
+    "custom",
+};
+
+// compile time checks that the tables cover every layer and map function
+typedef char layerNamesCheck[
+        sizeof(layerNames) / sizeof(*layerNames) == L_NUM+1 ? 1 : -1];
+
+#define FUNC(F) { F, #F }
+
+/* The zoom chains that mapZoom() evaluates together (mapZoomChain() in
+ * layers.c) are entered through mapZoom() and are counted under it.
+ */
+static const struct { mapfunc_t getMap; const char *name; } funcs[] =
+{
+    FUNC(mapIsland),
+    FUNC(mapZoomIsland),
+    FUNC(mapZoom),
+    FUNC(mapAddIsland),
+    FUNC(mapRemoveTooMuchOcean),
+    FUNC(mapAddSnow),
+    FUNC(mapCoolWarm),
+    FUNC(mapHeatIce),
+    FUNC(mapSpecial),
+    FUNC(mapAddMushroomIsland),
+    FUNC(mapDeepOcean),
+    FUNC(mapBiome),
+    FUNC(mapBiomeBE),
+    FUNC(mapAddBamboo),
+    FUNC(mapRiverInit),
+    FUNC(mapBiomeEdge),
+    FUNC(mapHills),
+    FUNC(mapHills112),
+    FUNC(mapRiver),
+    FUNC(mapSmooth),
+    FUNC(mapRareBiome),
+    FUNC(mapShore),
+    FUNC(mapRiverMix),
+    FUNC(mapOceanTemp),
+    FUNC(mapOceanMix),
+    FUNC(mapVoronoiZoom),
+    FUNC(mapVoronoiZoom114),
+    FUNC(mapApproxZoom4),
+    FUNC(mapApproxZoom16),
+    { NULL, "other" },
+};
+
+typedef char funcsCheck[
+        sizeof(funcs) / sizeof(*funcs) == PROFILE_FUNCS ? 1 : -1];
+
+/* The counters of a thread, which are kept in a list for the merge. */
+STRUCT(ProfileThread)
+{
+    LayerProfile prof;
+    uint64_t child;     // cycles of the calls from within the current one
+    ProfileThread *next;
+};
+
+static ProfileThread *profThreads;
+static THREAD_LOCAL ProfileThread *profThread;
+
+
+static inline uint64_t profileClock()
+{
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    return __rdtsc();
+#elif defined(_WIN32)
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+#endif
+}
+
+static ProfileThread *getProfileThread()
+{
+    ProfileThread *t = profThread;
+    if (t)
+        return t;
+
+    t = (ProfileThread *) calloc(1, sizeof(ProfileThread));
+    if (t == NULL)
+    {
+        fprintf(stderr, "getProfileThread(): Out of memory.\n");
+        exit(1);
+    }
+    // the threads are only ever added to the front of the list
+#ifdef _WIN32
+    do
+        t->next = profThreads;
+    while (InterlockedCompareExchangePointer(
+            (PVOID volatile *) &profThreads, t, t->next) != t->next);
+#else
+    do
+        t->next = profThreads;
+    while (!__sync_bool_compare_and_swap(&profThreads, t->next, t));
+#endif
+    profThread = t;
+    return t;
+}
+
+static inline void addCounter(ProfileCounter *c, uint64_t cells,
+        uint64_t cycles, uint64_t self)
+{
+    c->calls++;
+    c->cells += cells;
+    c->cycles += cycles;
+    c->self += self;
+}
+
+int profileGetMap(const Layer *l, int *out, int x, int z, int w, int h)
+{
+    ProfileThread *t = getProfileThread();
+    uint64_t outer = t->child;
+    int f, id;
+
+    t->child = 0;
+    uint64_t t0 = profileClock();
+    int err = l->getMap(l, out, x, z, w, h);
+    uint64_t dt = profileClock() - t0;
+    uint64_t self = dt > t->child ? dt - t->child : 0;
+    t->child = outer + dt;
+
+    id = l->id >= 0 && l->id < L_NUM ? l->id : L_NUM;
+    for (f = 0; f < PROFILE_FUNCS-1; f++)
+        if (funcs[f].getMap == l->getMap)
+            break;
+
+    uint64_t cells = (uint64_t)w * h;
+    addCounter(&t->prof.layers[id], cells, dt, self);
+    addCounter(&t->prof.funcs[f], cells, dt, self);
+    return err;
+}
+
+int getLayerProfile(LayerProfile *prof)
+{
+    ProfileThread *t;
+    uint64_t *dst = (uint64_t *) prof;
+    size_t i, n = sizeof(LayerProfile) / sizeof(uint64_t);
+
+    memset(prof, 0, sizeof(*prof));
+    for (t = profThreads; t; t = t->next)
+    {
+        const uint64_t *src = (const uint64_t *) &t->prof;
+        for (i = 0; i < n; i++)
+            dst[i] += src[i];
+    }
+
+#ifdef CUBIOMES_PROFILE
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+void resetLayerProfile(void)
+{
+    ProfileThread *t;
+    for (t = profThreads; t; t = t->next)
+        memset(&t->prof, 0, sizeof(t->prof));
+}
+
+const char *getProfileLayerName(int id)
+{
+    if (id < 0 || id > L_NUM)
+        return NULL;
+    return layerNames[id];
+}
+
+const char *getProfileFuncName(int f)
+{
+    if (f < 0 || f >= PROFILE_FUNCS)
+        return NULL;
+    return funcs[f].name;
+}
+
+
+static void printRow(FILE *fp, const char *name, const ProfileCounter *c,
+        uint64_t total)
+{
+    fprintf(fp, "%-22s %12llu %14llu %12.3f %12.3f %6.1f%% %10.2f\n",
+            name, (unsigned long long) c->calls, (unsigned long long) c->cells,
+            c->cycles * 1e-6, c->self * 1e-6,
+            total ? 100.0 * c->self / total : 0.0,
+            c->cells ? (double) c->self / c->cells : 0.0);
+}
+
+void printLayerProfile(FILE *fp, const LayerProfile *prof)
+{
+    uint64_t total = 0;
+    int i;
+
+    for (i = 0; i < PROFILE_FUNCS; i++)
+        total += prof->funcs[i].self;
+
+    const char *head = "%-22s %12s %14s %12s %12s %7s %10s\n";
+    fprintf(fp, head, "layer", "calls", "cells", "Mcycles", "self", "self", "self/cell");
+    for (i = 0; i <= L_NUM; i++)
+        if (prof->layers[i].calls)
+            printRow(fp, layerNames[i], &prof->layers[i], total);
+
+    fprintf(fp, "\n");
+    fprintf(fp, head, "function", "calls", "cells", "Mcycles", "self", "self", "self/cell");
+    for (i = 0; i < PROFILE_FUNCS; i++)
+        if (prof->funcs[i].calls)
+            printRow(fp, funcs[i].name, &prof->funcs[i], total);
+}
+
+static void printCounterJSON(FILE *fp, const char *name, int id,
+        const ProfileCounter *c)
+{
+    fprintf(fp, "{\"name\":\"%s\",", name);
+    if (id >= 0)
+        fprintf(fp, "\"id\":%d,", id);
+    fprintf(fp, "\"calls\":%llu,\"cells\":%llu,\"cycles\":%llu,\"self\":%llu}",
+            (unsigned long long) c->calls, (unsigned long long) c->cells,
+            (unsigned long long) c->cycles, (unsigned long long) c->self);
+}
+
+void printLayerProfileJSON(FILE *fp, const LayerProfile *prof)
+{
+    const char *sep = "";
+    int i;
+
+    fprintf(fp, "{\"layers\":[");
+    for (i = 0; i <= L_NUM; i++)
+    {
+        if (!prof->layers[i].calls)
+            continue;
+        fprintf(fp, "%s\n  ", sep);
+        printCounterJSON(fp, layerNames[i], i < L_NUM ? i : -1, &prof->layers[i]);
+        sep = ",";
+    }
+    fprintf(fp, "\n],\"functions\":[");
+    sep = "";
+    for (i = 0; i < PROFILE_FUNCS; i++)
+    {
+        if (!prof->funcs[i].calls)
+            continue;
+        fprintf(fp, "%s\n  ", sep);
+        printCounterJSON(fp, funcs[i].name, -1, &prof->funcs[i]);
+        sep = ",";
+    }
+    fprintf(fp, "\n]}\n");
+}
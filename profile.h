@@ -0,0 +1,68 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include "generator.h"
+
+#include <stdio.h>
+
+/* Per-layer profiling, which is recorded when the library is built with
+ * CUBIOMES_PROFILE defined (see the 'profile' target of the makefile). Each
+ * call of a map function through getLayerMap() counts towards the layer
+ * index in the generator (Layer.id) and towards the map function. The time
+ * is measured in time stamp counter cycles, both with and without the calls
+ * to the parents. A chain of zooms that mapZoom() evaluates together counts
+ * as a single call of its first layer and of mapZoom().
+ *
+ * Every thread counts on its own, and the counters of all threads are merged
+ * by getLayerProfile(). The counters of threads that are still running may
+ * be read while they are being updated.
+ */
+
+// map functions that are told apart, the last one stands for all others
+#define PROFILE_FUNCS 30
+
+STRUCT(ProfileCounter)
+{
+    uint64_t calls;     // number of map function calls
+    uint64_t cells;     // number of generated cells
+    uint64_t cycles;    // cycles spent in the calls
+    uint64_t self;      // cycles spent in the calls, without their parents
+};
+
+STRUCT(LayerProfile)
+{
+    ProfileCounter layers[L_NUM+1];         // by layer index, custom layers last
+    ProfileCounter funcs[PROFILE_FUNCS];    // by map function
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Merges the counters of all threads into 'prof'.
+ * Returns non-zero if the library was built without CUBIOMES_PROFILE.
+ */
+int getLayerProfile(LayerProfile *prof);
+
+/* Clears the counters of all threads. */
+void resetLayerProfile(void);
+
+/* Names of the layer index 'id' (L_NUM for custom layers) and of the map
+ * function 'f' of a profile.
+ */
+const char *getProfileLayerName(int id);
+const char *getProfileFuncName(int f);
+
+/* Prints the layers and map functions that were called as a table sorted by
+ * the layer index, or as a JSON object with the arrays "layers" and
+ * "functions".
+ */
+void printLayerProfile(FILE *fp, const LayerProfile *prof);
+void printLayerProfileJSON(FILE *fp, const LayerProfile *prof);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROFILE_H_ */
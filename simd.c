@@ -0,0 +1,1194 @@
+#include "simd.h"
+#include "layers.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2     __attribute__((target("sse2")))
+#define TARGET_AVX2     __attribute__((target("avx2")))
+#define TARGET_AVX512   __attribute__((target("avx512f,avx512dq")))
+#else
+#define SIMD_X86 0
+#endif
+
+// constants of the 32-bit chunk seed recurrence in mapZoom
+#define ZOOM_MUL    1284865837
+#define ZOOM_ADD    ((int)4150755663U)
+#define BIT24       (1 << 24)
+
+// constants of mcStepSeed()
+#define LCG_MUL     6364136223846793005LL
+#define LCG_ADD     1442695040888963407LL
+
+// (cs >> 24) % mod == 0 is tested on the residue modulo 15, which is folded
+// into a small positive number, through the multiplicative inverse of mod
+#define FOLD15      (15*65536)
+#define INV3        0xAAAAAAABLL
+#define LIM3        0x55555555LL
+#define INV5        0xCCCCCCCDLL
+#define LIM5        0x33333333LL
+
+// Along a row, the chunk seed of getChunkSeed() is a polynomial of degree 8 in
+// x (modulo 2^64), so for long rows it is advanced by forward differences,
+// which replaces the dependent multiplications with additions.
+#define POLY_DEG    8
+#define POLY_MIN    (2 * POLY_DEG)  // minimum number of vectors in a row
+
+
+//==============================================================================
+// Dispatch
+//==============================================================================
+
+static int simdLevel = -1;
+
+int getSimdSupport(void)
+{
+#if SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+        return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SIMD_SSE2;
+#endif
+    return SIMD_NONE;
+}
+
+int getSimdLevel(void)
+{
+    if (simdLevel < 0)
+        simdLevel = getSimdSupport();
+    return simdLevel;
+}
+
+int setSimdLevel(int level)
+{
+    int support = getSimdSupport();
+    if (level < 0 || level > support)
+        level = support;
+    simdLevel = level;
+    return level;
+}
+
+
+//==============================================================================
+// Biome Properties
+//==============================================================================
+
+// biome properties used by the neighbour rules of mapShore and mapBiomeEdge
+enum
+{
+    F_OCEANIC   = 0x001,    // isOceanic()
+    F_JUNGLE    = 0x002,    // getBiomeType() == Jungle
+    F_JFTO      = 0x004,    // jungle, forest, taiga or oceanic
+    F_MESA      = 0x008,    // getBiomeType() == Mesa
+    F_SNOWY     = 0x010,    // isBiomeSnowy()
+    F_SIM_WBP   = 0x020,    // areSimilar(id, wooded_badlands_plateau)
+    F_SIM_BP    = 0x040,    // areSimilar(id, badlands_plateau)
+    F_SIM_GTT   = 0x080,    // areSimilar(id, giant_tree_taiga)
+};
+
+static int biomeFlags[256];
+
+void initSimdTables(void)
+{
+    int id;
+
+    // select the level up front, so the generation threads only read it
+    if (simdLevel < 0)
+        simdLevel = getSimdSupport();
+
+    for (id = 0; id < 256; id++)
+    {
+        int f = 0;
+        if (isOceanic(id))
+            f |= F_OCEANIC | F_JFTO;
+        if (getBiomeType(id) == Jungle)
+            f |= F_JUNGLE | F_JFTO;
+        if (id == forest || id == taiga)
+            f |= F_JFTO;
+        if (getBiomeType(id) == Mesa)
+            f |= F_MESA;
+        if (isBiomeSnowy(id))
+            f |= F_SNOWY;
+        if (areSimilar(id, wooded_badlands_plateau))
+            f |= F_SIM_WBP;
+        if (areSimilar(id, badlands_plateau))
+            f |= F_SIM_BP;
+        if (areSimilar(id, giant_tree_taiga))
+            f |= F_SIM_GTT;
+        biomeFlags[id] = f;
+    }
+}
+
+
+#if SIMD_X86
+
+//==============================================================================
+// SSE2
+//==============================================================================
+
+TARGET_SSE2
+static inline __m128i sse2Mullo(__m128i a, __m128i b)
+{
+    // there is no 32-bit multiply-low before SSE4.1
+    __m128i ev = _mm_mul_epu32(a, b);
+    __m128i od = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(ev, _MM_SHUFFLE(0,0,2,0)),
+                              _mm_shuffle_epi32(od, _MM_SHUFFLE(0,0,2,0)));
+}
+
+TARGET_SSE2
+static inline __m128i sse2Sel(__m128i m, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+}
+
+TARGET_SSE2
+static inline __m128i sse2ZoomStep(__m128i cs, __m128i salt)
+{
+    __m128i t = _mm_add_epi32(sse2Mullo(cs, _mm_set1_epi32(ZOOM_MUL)),
+                              _mm_set1_epi32(ZOOM_ADD));
+    return _mm_add_epi32(sse2Mullo(cs, t), salt);
+}
+
+TARGET_SSE2
+static int zoomRowSSE2(const int *p0, const int *p1, int *b0, int *b1, int n,
+        int chunkX, int chunkZ, int ss, int st, int island)
+{
+    const __m128i vss = _mm_set1_epi32(ss);
+    const __m128i vst = _mm_set1_epi32(st);
+    const __m128i cz = _mm_set1_epi32(chunkZ);
+    const __m128i bit = _mm_set1_epi32(BIT24);
+    const __m128i three = _mm_set1_epi32(3);
+    __m128i cx = _mm_add_epi32(_mm_set1_epi32(chunkX), _mm_setr_epi32(0, 2, 4, 6));
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4, cx = _mm_add_epi32(cx, _mm_set1_epi32(8)))
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(p0 + i));
+        __m128i c = _mm_loadu_si128((const __m128i*)(p0 + i + 1));
+        __m128i b = _mm_loadu_si128((const __m128i*)(p1 + i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(p1 + i + 1));
+
+        __m128i cs = _mm_add_epi32(vss, cx);
+        cs = sse2ZoomStep(cs, cz);
+        cs = sse2ZoomStep(cs, cx);
+        cs = sse2ZoomStep(cs, cz);
+        __m128i vb = sse2Sel(_mm_cmpeq_epi32(_mm_and_si128(cs, bit), bit), b, a);
+
+        cs = sse2ZoomStep(cs, vst);
+        __m128i vc = sse2Sel(_mm_cmpeq_epi32(_mm_and_si128(cs, bit), bit), c, a);
+
+        __m128i r = _mm_and_si128(_mm_srli_epi32(sse2ZoomStep(cs, vst), 24), three);
+        __m128i vd =
+            sse2Sel(_mm_cmpeq_epi32(r, _mm_setzero_si128()), a,
+            sse2Sel(_mm_cmpeq_epi32(r, _mm_set1_epi32(1)), c,
+            sse2Sel(_mm_cmpeq_epi32(r, _mm_set1_epi32(2)), b, d)));
+
+        if (!island)
+        {
+            // select4() with the counts as sums of negative masks
+            __m128i n00 = _mm_add_epi32(_mm_add_epi32(
+                _mm_cmpeq_epi32(a, c), _mm_cmpeq_epi32(a, b)), _mm_cmpeq_epi32(a, d));
+            __m128i n10 = _mm_add_epi32(_mm_cmpeq_epi32(c, b), _mm_cmpeq_epi32(c, d));
+            __m128i n01 = _mm_cmpeq_epi32(b, d);
+            __m128i m00 = _mm_and_si128(_mm_cmplt_epi32(n00, n10), _mm_cmplt_epi32(n00, n01));
+            vd = sse2Sel(m00, a,
+                 sse2Sel(_mm_cmplt_epi32(n10, n00), c,
+                 sse2Sel(_mm_cmplt_epi32(n01, n00), b, vd)));
+        }
+
+        _mm_storeu_si128((__m128i*)(b0 + 2*i + 0), _mm_unpacklo_epi32(a, vc));
+        _mm_storeu_si128((__m128i*)(b0 + 2*i + 4), _mm_unpackhi_epi32(a, vc));
+        _mm_storeu_si128((__m128i*)(b1 + 2*i + 0), _mm_unpacklo_epi32(vb, vd));
+        _mm_storeu_si128((__m128i*)(b1 + 2*i + 4), _mm_unpackhi_epi32(vb, vd));
+    }
+
+    return i;
+}
+
+
+//==============================================================================
+// AVX2
+//==============================================================================
+
+TARGET_AVX2
+static inline __m256i avx2Sel(__m256i m, __m256i a, __m256i b)
+{
+    return _mm256_blendv_epi8(b, a, m);
+}
+
+TARGET_AVX2
+static inline __m256i avx2ZoomStep(__m256i cs, __m256i salt)
+{
+    __m256i t = _mm256_add_epi32(_mm256_mullo_epi32(cs, _mm256_set1_epi32(ZOOM_MUL)),
+                                 _mm256_set1_epi32(ZOOM_ADD));
+    return _mm256_add_epi32(_mm256_mullo_epi32(cs, t), salt);
+}
+
+TARGET_AVX2
+static inline void avx2StorePairs(int *dst, __m256i a, __m256i b)
+{
+    __m256i lo = _mm256_unpacklo_epi32(a, b);
+    __m256i hi = _mm256_unpackhi_epi32(a, b);
+    _mm256_storeu_si256((__m256i*)(dst + 0), _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i*)(dst + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+TARGET_AVX2
+static int zoomRowAVX2(const int *p0, const int *p1, int *b0, int *b1, int n,
+        int chunkX, int chunkZ, int ss, int st, int island)
+{
+    const __m256i vss = _mm256_set1_epi32(ss);
+    const __m256i vst = _mm256_set1_epi32(st);
+    const __m256i cz = _mm256_set1_epi32(chunkZ);
+    const __m256i bit = _mm256_set1_epi32(BIT24);
+    const __m256i three = _mm256_set1_epi32(3);
+    __m256i cx = _mm256_add_epi32(_mm256_set1_epi32(chunkX),
+            _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14));
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8, cx = _mm256_add_epi32(cx, _mm256_set1_epi32(16)))
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(p0 + i));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(p0 + i + 1));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p1 + i));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(p1 + i + 1));
+
+        __m256i cs = _mm256_add_epi32(vss, cx);
+        cs = avx2ZoomStep(cs, cz);
+        cs = avx2ZoomStep(cs, cx);
+        cs = avx2ZoomStep(cs, cz);
+        __m256i vb = avx2Sel(_mm256_cmpeq_epi32(_mm256_and_si256(cs, bit), bit), b, a);
+
+        cs = avx2ZoomStep(cs, vst);
+        __m256i vc = avx2Sel(_mm256_cmpeq_epi32(_mm256_and_si256(cs, bit), bit), c, a);
+
+        __m256i r = _mm256_and_si256(_mm256_srli_epi32(avx2ZoomStep(cs, vst), 24), three);
+        __m256i vd =
+            avx2Sel(_mm256_cmpeq_epi32(r, _mm256_setzero_si256()), a,
+            avx2Sel(_mm256_cmpeq_epi32(r, _mm256_set1_epi32(1)), c,
+            avx2Sel(_mm256_cmpeq_epi32(r, _mm256_set1_epi32(2)), b, d)));
+
+        if (!island)
+        {
+            // select4() with the counts as sums of negative masks
+            __m256i n00 = _mm256_add_epi32(_mm256_add_epi32(
+                _mm256_cmpeq_epi32(a, c), _mm256_cmpeq_epi32(a, b)), _mm256_cmpeq_epi32(a, d));
+            __m256i n10 = _mm256_add_epi32(_mm256_cmpeq_epi32(c, b), _mm256_cmpeq_epi32(c, d));
+            __m256i n01 = _mm256_cmpeq_epi32(b, d);
+            __m256i m00 = _mm256_and_si256(_mm256_cmpgt_epi32(n10, n00), _mm256_cmpgt_epi32(n01, n00));
+            vd = avx2Sel(m00, a,
+                 avx2Sel(_mm256_cmpgt_epi32(n00, n10), c,
+                 avx2Sel(_mm256_cmpgt_epi32(n00, n01), b, vd)));
+        }
+
+        avx2StorePairs(b0 + 2*i, a, vc);
+        avx2StorePairs(b1 + 2*i, vb, vd);
+    }
+
+    return i;
+}
+
+
+TARGET_AVX2
+static inline __m256i avx2Load(const int *p)
+{
+    return _mm256_loadu_si256((const __m256i*)p);
+}
+
+TARGET_AVX2
+static inline void avx2Store(int *p, __m256i v)
+{
+    _mm256_storeu_si256((__m256i*)p, v);
+}
+
+TARGET_AVX2
+static inline __m256i avx2Eq(__m256i a, int b)
+{
+    return _mm256_cmpeq_epi32(a, _mm256_set1_epi32(b));
+}
+
+// mask of lanes where any of the four neighbours equals 'b'
+TARGET_AVX2
+static inline __m256i avx2AnyEq(__m256i n0, __m256i n1, __m256i n2, __m256i n3, int b)
+{
+    return _mm256_or_si256(_mm256_or_si256(avx2Eq(n0, b), avx2Eq(n1, b)),
+                           _mm256_or_si256(avx2Eq(n2, b), avx2Eq(n3, b)));
+}
+
+// mask of lanes where 'flag' is set in each of the four flag vectors
+TARGET_AVX2
+static inline __m256i avx2AllFlag(__m256i f0, __m256i f1, __m256i f2, __m256i f3, int flag)
+{
+    __m256i a = _mm256_and_si256(_mm256_and_si256(f0, f1), _mm256_and_si256(f2, f3));
+    return avx2Eq(_mm256_and_si256(a, _mm256_set1_epi32(flag)), flag);
+}
+
+TARGET_AVX2
+static inline __m256i avx2AnyFlag(__m256i f0, __m256i f1, __m256i f2, __m256i f3, int flag)
+{
+    __m256i a = _mm256_or_si256(_mm256_or_si256(f0, f1), _mm256_or_si256(f2, f3));
+    return _mm256_xor_si256(avx2Eq(_mm256_and_si256(a, _mm256_set1_epi32(flag)), 0),
+                            _mm256_set1_epi32(-1));
+}
+
+TARGET_AVX2
+static inline __m256i avx2Flags(__m256i id)
+{
+    return _mm256_i32gather_epi32(biomeFlags, id, 4);
+}
+
+// true if all lanes of the cross hold valid biome IDs for the flag table
+TARGET_AVX2
+static inline int avx2InRange(__m256i a, __m256i b, __m256i c, __m256i d, __m256i e)
+{
+    __m256i v = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, _mm256_or_si256(d, e)));
+    return _mm256_testz_si256(v, _mm256_set1_epi32(~0xff));
+}
+
+TARGET_AVX2
+static inline __m256i avx2ReduceID(__m256i id)
+{
+    __m256i r = _mm256_add_epi32(_mm256_and_si256(id, _mm256_set1_epi32(1)),
+                                 _mm256_set1_epi32(2));
+    return avx2Sel(_mm256_cmpgt_epi32(id, _mm256_set1_epi32(1)), r, id);
+}
+
+TARGET_AVX2
+static int riverRowAVX2(const int *vz0, const int *vz1, const int *vz2, int *dst, int n)
+{
+    int i;
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        __m256i v01 = avx2ReduceID(avx2Load(vz1 + i + 0));
+        __m256i v11 = avx2ReduceID(avx2Load(vz1 + i + 1));
+        __m256i v21 = avx2ReduceID(avx2Load(vz1 + i + 2));
+        __m256i v10 = avx2ReduceID(avx2Load(vz0 + i + 1));
+        __m256i v12 = avx2ReduceID(avx2Load(vz2 + i + 1));
+
+        __m256i eq = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi32(v11, v01), _mm256_cmpeq_epi32(v11, v10)),
+            _mm256_and_si256(_mm256_cmpeq_epi32(v11, v12), _mm256_cmpeq_epi32(v11, v21)));
+        avx2Store(dst + i, avx2Sel(eq, _mm256_set1_epi32(-1), _mm256_set1_epi32(river)));
+    }
+    return i;
+}
+
+TARGET_AVX2
+static int smoothRowAVX2(const int *vz0, const int *vz1, const int *vz2, int *dst,
+        int n, int x, int z, int64_t ss)
+{
+    int i;
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        __m256i v11 = avx2Load(vz1 + i + 1);
+        __m256i v01 = avx2Load(vz1 + i + 0);
+        __m256i v10 = avx2Load(vz0 + i + 1);
+        __m256i v21 = avx2Load(vz1 + i + 2);
+        __m256i v12 = avx2Load(vz2 + i + 1);
+
+        __m256i same = _mm256_and_si256(_mm256_cmpeq_epi32(v11, v01),
+                                        _mm256_cmpeq_epi32(v11, v10));
+        __m256i e1 = _mm256_cmpeq_epi32(v01, v21);
+        __m256i e2 = _mm256_cmpeq_epi32(v10, v12);
+        __m256i v = avx2Sel(e2, v10, avx2Sel(e1, v01, v11));
+
+        // cells that need the PRNG to choose between v10 and v01 are rare
+        __m256i rnd = _mm256_andnot_si256(same, _mm256_and_si256(e1, e2));
+        int m = _mm256_movemask_ps(_mm256_castsi256_ps(rnd));
+        if U(m)
+        {
+            int a10[8], a01[8], r[8];
+            avx2Store(a10, v10);
+            avx2Store(a01, v01);
+            avx2Store(r, v);
+            while (m)
+            {
+                int k = __builtin_ctz(m);
+                int64_t cs = getChunkSeed(ss, x+i+k, z);
+                r[k] = (cs & ((int64_t)1 << 24)) ? a10[k] : a01[k];
+                m &= m - 1;
+            }
+            v = avx2Load(r);
+        }
+
+        avx2Store(dst + i, avx2Sel(same, v11, v));
+    }
+    return i;
+}
+
+TARGET_AVX2
+static inline __m256i avx2IsShallowOcean(__m256i v)
+{
+    return _mm256_or_si256(
+        _mm256_or_si256(avx2Eq(v, ocean), avx2Eq(v, frozen_ocean)),
+        _mm256_or_si256(avx2Eq(v, warm_ocean),
+            _mm256_or_si256(avx2Eq(v, lukewarm_ocean), avx2Eq(v, cold_ocean))));
+}
+
+TARGET_AVX2
+static int deepOceanRowAVX2(const int *vz0, const int *vz1, const int *vz2, int *dst, int n)
+{
+    int i;
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        __m256i v11 = avx2Load(vz1 + i + 1);
+        __m256i deep = _mm256_and_si256(
+            _mm256_and_si256(avx2IsShallowOcean(v11), avx2IsShallowOcean(avx2Load(vz0 + i + 1))),
+            _mm256_and_si256(
+                _mm256_and_si256(avx2IsShallowOcean(avx2Load(vz1 + i + 2)),
+                                 avx2IsShallowOcean(avx2Load(vz1 + i + 0))),
+                avx2IsShallowOcean(avx2Load(vz2 + i + 1))));
+
+        if (!_mm256_testz_si256(deep, deep))
+        {
+            __m256i d = _mm256_set1_epi32(deep_ocean);
+            d = avx2Sel(avx2Eq(v11, warm_ocean), _mm256_set1_epi32(deep_warm_ocean), d);
+            d = avx2Sel(avx2Eq(v11, lukewarm_ocean), _mm256_set1_epi32(deep_lukewarm_ocean), d);
+            d = avx2Sel(avx2Eq(v11, cold_ocean), _mm256_set1_epi32(deep_cold_ocean), d);
+            d = avx2Sel(avx2Eq(v11, frozen_ocean), _mm256_set1_epi32(deep_frozen_ocean), d);
+            v11 = avx2Sel(deep, d, v11);
+        }
+        avx2Store(dst + i, v11);
+    }
+    return i;
+}
+
+TARGET_AVX2
+static int biomeEdgeRowAVX2(const int *vz0, const int *vz1, const int *vz2, int *dst, int n)
+{
+    int i;
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        __m256i v11 = avx2Load(vz1 + i + 1);
+        __m256i v10 = avx2Load(vz0 + i + 1);
+        __m256i v21 = avx2Load(vz1 + i + 2);
+        __m256i v01 = avx2Load(vz1 + i + 0);
+        __m256i v12 = avx2Load(vz2 + i + 1);
+        __m256i v = v11;
+
+        // replaceEdge() for the plateaus and giant tree taiga
+        __m256i wbp = avx2Eq(v11, wooded_badlands_plateau);
+        __m256i bp = avx2Eq(v11, badlands_plateau);
+        __m256i gtt = avx2Eq(v11, giant_tree_taiga);
+        __m256i edge = _mm256_or_si256(_mm256_or_si256(wbp, bp), gtt);
+        if (!_mm256_testz_si256(edge, edge))
+        {
+            if (!avx2InRange(v11, v10, v21, v01, v12))
+                break;
+            __m256i f10 = avx2Flags(v10), f21 = avx2Flags(v21);
+            __m256i f01 = avx2Flags(v01), f12 = avx2Flags(v12);
+            __m256i r;
+            r = avx2Sel(avx2AllFlag(f10, f21, f01, f12, F_SIM_GTT), v11, _mm256_set1_epi32(taiga));
+            v = avx2Sel(gtt, r, v);
+            r = avx2Sel(avx2AllFlag(f10, f21, f01, f12, F_SIM_BP), v11, _mm256_set1_epi32(badlands));
+            v = avx2Sel(bp, r, v);
+            r = avx2Sel(avx2AllFlag(f10, f21, f01, f12, F_SIM_WBP), v11, _mm256_set1_epi32(badlands));
+            v = avx2Sel(wbp, r, v);
+        }
+
+        __m256i des = avx2Eq(v11, desert);
+        __m256i swa = avx2Eq(v11, swamp);
+        if (!_mm256_testz_si256(_mm256_or_si256(des, swa), _mm256_set1_epi32(-1)))
+        {
+            __m256i tundra = avx2AnyEq(v10, v21, v01, v12, snowy_tundra);
+            __m256i cold = _mm256_or_si256(tundra, _mm256_or_si256(
+                avx2AnyEq(v10, v21, v01, v12, desert),
+                avx2AnyEq(v10, v21, v01, v12, snowy_taiga)));
+            __m256i jung = _mm256_or_si256(
+                avx2AnyEq(v10, v21, v01, v12, jungle),
+                avx2AnyEq(v10, v21, v01, v12, bamboo_jungle));
+
+            v = avx2Sel(des, avx2Sel(tundra, _mm256_set1_epi32(wooded_mountains), v11), v);
+            v = avx2Sel(swa, avx2Sel(cold, _mm256_set1_epi32(plains),
+                             avx2Sel(jung, _mm256_set1_epi32(jungle_edge), v11)), v);
+        }
+
+        avx2Store(dst + i, v);
+    }
+    return i;
+}
+
+TARGET_AVX2
+static int shoreRowAVX2(const int *vz0, const int *vz1, const int *vz2, int *dst, int n)
+{
+    int i;
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        __m256i v11 = avx2Load(vz1 + i + 1);
+        __m256i v10 = avx2Load(vz0 + i + 1);
+        __m256i v21 = avx2Load(vz1 + i + 2);
+        __m256i v01 = avx2Load(vz1 + i + 0);
+        __m256i v12 = avx2Load(vz2 + i + 1);
+
+        if (!avx2InRange(v11, v10, v21, v01, v12))
+            break;
+
+        __m256i old = avx2Load(dst + i);
+        __m256i f11 = avx2Flags(v11);
+
+        __m256i c11 = _mm256_xor_si256(avx2Eq(_mm256_and_si256(f11, _mm256_set1_epi32(F_OCEANIC)), 0),
+                                       _mm256_set1_epi32(-1));
+        __m256i snowy = avx2Eq(_mm256_and_si256(f11, _mm256_set1_epi32(F_SNOWY)), F_SNOWY);
+        __m256i water = _mm256_or_si256(
+            _mm256_or_si256(avx2Eq(v11, ocean), avx2Eq(v11, deep_ocean)),
+            _mm256_or_si256(avx2Eq(v11, river), avx2Eq(v11, swamp)));
+        __m256i v, r;
+
+        // cells surrounded by their own biome keep it, except for oceans,
+        // which only have ocean neighbours
+        __m256i same = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi32(v11, v10), _mm256_cmpeq_epi32(v11, v21)),
+            _mm256_and_si256(_mm256_cmpeq_epi32(v11, v01), _mm256_cmpeq_epi32(v11, v12)));
+        if (_mm256_movemask_epi8(same) == -1)
+        {
+            r = avx2Sel(snowy, old, avx2Sel(water, v11, _mm256_set1_epi32(beach)));
+            avx2Store(dst + i, avx2Sel(c11, r, v11));
+            continue;
+        }
+
+        __m256i f10 = avx2Flags(v10), f21 = avx2Flags(v21);
+        __m256i f01 = avx2Flags(v01), f12 = avx2Flags(v12);
+        __m256i anyOcean = avx2AnyFlag(f10, f21, f01, f12, F_OCEANIC);
+
+        // default rule
+        v = avx2Sel(_mm256_andnot_si256(water, anyOcean), _mm256_set1_epi32(beach), v11);
+
+        // badlands
+        __m256i mesa = _mm256_or_si256(avx2Eq(v11, badlands), avx2Eq(v11, wooded_badlands_plateau));
+        r = avx2Sel(_mm256_andnot_si256(anyOcean, _mm256_xor_si256(
+                avx2AllFlag(f10, f21, f01, f12, F_MESA), _mm256_set1_epi32(-1))),
+                _mm256_set1_epi32(desert), v11);
+        v = avx2Sel(mesa, r, v);
+
+        // snowy biomes and mountains: replaceOcean()
+        r = avx2Sel(c11, old, avx2Sel(anyOcean, _mm256_set1_epi32(snowy_beach), v11));
+        v = avx2Sel(snowy, r, v);
+
+        __m256i mount = _mm256_or_si256(avx2Eq(v11, mountains),
+            _mm256_or_si256(avx2Eq(v11, wooded_mountains), avx2Eq(v11, mountain_edge)));
+        r = avx2Sel(c11, old, avx2Sel(anyOcean, _mm256_set1_epi32(stone_shore), v11));
+        v = avx2Sel(mount, r, v);
+
+        // jungles
+        __m256i jung = avx2Eq(_mm256_and_si256(f11, _mm256_set1_epi32(F_JUNGLE)), F_JUNGLE);
+        r = avx2Sel(avx2AllFlag(f10, f21, f01, f12, F_JFTO),
+                avx2Sel(anyOcean, _mm256_set1_epi32(beach), v11),
+                _mm256_set1_epi32(jungle_edge));
+        v = avx2Sel(jung, r, v);
+
+        // mushroom fields
+        __m256i mush = avx2Eq(v11, mushroom_fields);
+        r = avx2Sel(avx2AnyEq(v10, v21, v01, v12, ocean),
+                _mm256_set1_epi32(mushroom_field_shore), v11);
+        v = avx2Sel(mush, r, v);
+
+        avx2Store(dst + i, v);
+    }
+    return i;
+}
+
+// stores the low halves of four 64-bit lanes as ints
+TARGET_AVX2
+static inline void avx2Store4(int *p, __m256i v)
+{
+    __m256i idx = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+    v = _mm256_permutevar8x32_epi32(v, idx);
+    _mm_storeu_si128((__m128i*)p, _mm256_castsi256_si128(v));
+}
+
+TARGET_AVX2
+static void voronoiBlockAVX2(int *blk, const int *cx, const int *cy, const int *cz,
+        const int *cv)
+{
+    const int A = 40*1024;
+    const int B = 20*1024;
+    const __m256i dx = _mm256_setr_epi64x(0, 10*1024, 20*1024, 30*1024);
+    __m256i rx[8];
+    int jj, k;
+
+    for (k = 0; k < 8; k++)
+        rx[k] = _mm256_add_epi64(dx, _mm256_set1_epi64x(cx[k] - ((k & 2) ? A : 0)));
+
+    for (jj = 0; jj < 4; jj++)
+    {
+        __m256i dmin = _mm256_set1_epi64x(INT64_MAX);
+        __m256i v = _mm256_setzero_si256();
+
+        // the candidates are compared in the same order as the scalar code,
+        // so ties resolve identically
+        for (k = 0; k < 8; k++)
+        {
+            int64_t ry = cy[k] + ((k & 1) ? -B : B);
+            int64_t rz = cz[k] - ((k & 4) ? A : 0) + jj * 10*1024;
+            __m256i d = _mm256_add_epi64(_mm256_mul_epi32(rx[k], rx[k]),
+                                         _mm256_set1_epi64x(ry*ry + rz*rz));
+            __m256i m = _mm256_cmpgt_epi64(dmin, d);
+            dmin = avx2Sel(m, d, dmin);
+            v = avx2Sel(m, _mm256_set1_epi64x(cv[k]), v);
+        }
+        avx2Store4(blk + 4*jj, v);
+    }
+}
+
+TARGET_AVX2
+static void voronoi114BlockAVX2(int *p, int stride, const int64_t *off, const int *cv)
+{
+    const __m256i mi = _mm256_setr_epi64x(0, 10240, 20480, 30720);
+    __m256i ra = _mm256_sub_epi64(mi, _mm256_set1_epi64x(off[0]));
+    __m256i rb = _mm256_sub_epi64(mi, _mm256_set1_epi64x(off[2]));
+    __m256i rc = _mm256_sub_epi64(mi, _mm256_set1_epi64x(off[4]));
+    __m256i rd = _mm256_sub_epi64(mi, _mm256_set1_epi64x(off[6]));
+    __m256i sa = _mm256_mul_epi32(ra, ra);
+    __m256i sb = _mm256_mul_epi32(rb, rb);
+    __m256i sc = _mm256_mul_epi32(rc, rc);
+    __m256i sd = _mm256_mul_epi32(rd, rd);
+    int jj;
+
+    for (jj = 0; jj < 4; jj++)
+    {
+        int64_t mj = 10240*jj;
+        __m256i da = _mm256_add_epi64(sa, _mm256_set1_epi64x((mj-off[1]) * (mj-off[1])));
+        __m256i db = _mm256_add_epi64(sb, _mm256_set1_epi64x((mj-off[3]) * (mj-off[3])));
+        __m256i dc = _mm256_add_epi64(sc, _mm256_set1_epi64x((mj-off[5]) * (mj-off[5])));
+        __m256i dd = _mm256_add_epi64(sd, _mm256_set1_epi64x((mj-off[7]) * (mj-off[7])));
+
+        __m256i ma = _mm256_and_si256(_mm256_cmpgt_epi64(db, da),
+                _mm256_and_si256(_mm256_cmpgt_epi64(dc, da), _mm256_cmpgt_epi64(dd, da)));
+        __m256i mb = _mm256_and_si256(_mm256_cmpgt_epi64(da, db),
+                _mm256_and_si256(_mm256_cmpgt_epi64(dc, db), _mm256_cmpgt_epi64(dd, db)));
+        __m256i mc = _mm256_and_si256(_mm256_cmpgt_epi64(da, dc),
+                _mm256_and_si256(_mm256_cmpgt_epi64(db, dc), _mm256_cmpgt_epi64(dd, dc)));
+
+        __m256i v = avx2Sel(ma, _mm256_set1_epi64x(cv[0]),
+                    avx2Sel(mb, _mm256_set1_epi64x(cv[1]),
+                    avx2Sel(mc, _mm256_set1_epi64x(cv[2]), _mm256_set1_epi64x(cv[3]))));
+        avx2Store4(p + jj*stride, v);
+    }
+}
+
+// 64-bit multiply from three 32-bit ones, as AVX2 has no 64-bit mullo
+TARGET_AVX2
+static inline __m256i avx2Mullo64(__m256i a, __m256i b)
+{
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i hi = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                  _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+}
+
+TARGET_AVX2
+static inline __m256i avx2StepSeed(__m256i s, __m256i salt)
+{
+    __m256i t = _mm256_add_epi64(avx2Mullo64(s, _mm256_set1_epi64x(LCG_MUL)),
+                                 _mm256_set1_epi64x(LCG_ADD));
+    return _mm256_add_epi64(avx2Mullo64(s, t), salt);
+}
+
+// mask of lanes where mcFirstIsZero(cs, mod) for mod = 3 or 5; only the low
+// 32 bits of the fold are used, so the arithmetic shift by 44 is done on the
+// high halves of the lanes
+TARGET_AVX2
+static inline __m256i avx2IsZeroMod(__m256i cs, int64_t inv, int64_t lim)
+{
+    __m256i hi = _mm256_srai_epi32(_mm256_srli_epi64(cs, 32), 12);
+    __m256i lo = _mm256_and_si256(_mm256_srli_epi64(cs, 24), _mm256_set1_epi64x(0xfffff));
+    __m256i f = _mm256_add_epi64(_mm256_add_epi64(hi, lo), _mm256_set1_epi64x(FOLD15));
+    f = _mm256_and_si256(_mm256_mul_epu32(f, _mm256_set1_epi64x(inv)),
+                         _mm256_set1_epi64x(0xffffffff));
+    return _mm256_cmpgt_epi64(_mm256_set1_epi64x(lim + 1), f);
+}
+
+// mask of lanes where the bits 'b' of (cs >> 24) are zero
+TARGET_AVX2
+static inline __m256i avx2IsZeroBits(__m256i cs, __m256i b)
+{
+    return _mm256_cmpeq_epi64(_mm256_and_si256(cs, b), _mm256_setzero_si256());
+}
+
+TARGET_AVX2
+static inline __m256i avx2Load4(const int *p)
+{
+    return _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)p));
+}
+
+TARGET_AVX2
+static int addIslandRowAVX2(const int *vz0, const int *vz1, const int *vz2,
+        int *dst, int n, int x, int z, int64_t ss, int64_t st)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi64x(-1);
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i two = _mm256_set1_epi64x(2);
+    const __m256i three = _mm256_set1_epi64x(3);
+    const __m256i four = _mm256_set1_epi64x(4);
+    const __m256i bit0 = _mm256_set1_epi64x(1LL << 24);
+    const __m256i bits01 = _mm256_set1_epi64x(3LL << 24);
+    const __m256i vst = _mm256_set1_epi64x(st);
+    const __m256i vz = _mm256_set1_epi64x(z);
+    __m256i vx = _mm256_add_epi64(_mm256_set1_epi64x(x), _mm256_setr_epi64x(0, 1, 2, 3));
+    __m256i d[POLY_DEG+1];
+    int poly = n / 4 >= POLY_MIN;
+    int i, k;
+
+    if (poly)
+    {
+        for (k = 0; k <= POLY_DEG; k++)
+        {
+            __m256i px = _mm256_add_epi64(vx, _mm256_set1_epi64x(4 * k));
+            d[k] = _mm256_add_epi64(_mm256_set1_epi64x(ss), px);
+            d[k] = avx2StepSeed(d[k], vz);
+            d[k] = avx2StepSeed(d[k], px);
+            d[k] = avx2StepSeed(d[k], vz);
+        }
+        for (k = 1; k <= POLY_DEG; k++)
+        {
+            int m;
+            for (m = POLY_DEG; m >= k; m--)
+                d[m] = _mm256_sub_epi64(d[m], d[m-1]);
+        }
+    }
+
+    for (i = 0; i + 4 <= n; i += 4, vx = _mm256_add_epi64(vx, _mm256_set1_epi64x(4)))
+    {
+        __m256i cs0;
+        if (poly)
+        {
+            cs0 = d[0];
+            for (k = 0; k < POLY_DEG; k++)
+                d[k] = _mm256_add_epi64(d[k], d[k+1]);
+        }
+
+        __m256i v00 = avx2Load4(vz0 + i);
+        __m256i v20 = avx2Load4(vz0 + i + 2);
+        __m256i v02 = avx2Load4(vz2 + i);
+        __m256i v22 = avx2Load4(vz2 + i + 2);
+        __m256i v11 = avx2Load4(vz1 + i + 1);
+
+        __m256i n00 = _mm256_xor_si256(_mm256_cmpeq_epi64(v00, zero), ones);
+        __m256i n20 = _mm256_xor_si256(_mm256_cmpeq_epi64(v20, zero), ones);
+        __m256i n02 = _mm256_xor_si256(_mm256_cmpeq_epi64(v02, zero), ones);
+        __m256i n22 = _mm256_xor_si256(_mm256_cmpeq_epi64(v22, zero), ones);
+        __m256i all = _mm256_and_si256(_mm256_and_si256(n00, n20), _mm256_and_si256(n02, n22));
+        __m256i any = _mm256_or_si256(_mm256_or_si256(n00, n20), _mm256_or_si256(n02, n22));
+        __m256i z11 = _mm256_cmpeq_epi64(v11, zero);
+        __m256i f11 = _mm256_cmpeq_epi64(v11, four);
+        __m256i sea = _mm256_and_si256(z11, any);
+
+        // cells that do not border a coast keep their value
+        __m256i inland = _mm256_or_si256(_mm256_or_si256(z11, f11), all);
+        if (_mm256_testc_si256(inland, ones) && _mm256_testz_si256(sea, sea))
+        {
+            avx2Store4(dst + i, v11);
+            continue;
+        }
+
+        if (!poly)
+        {
+            cs0 = _mm256_add_epi64(_mm256_set1_epi64x(ss), vx);
+            cs0 = avx2StepSeed(cs0, vz);
+            cs0 = avx2StepSeed(cs0, vx);
+            cs0 = avx2StepSeed(cs0, vz);
+        }
+
+        // ocean cell: the land neighbours are counted in 'inc' and each of
+        // them advances the PRNG of its cell
+        __m256i land = zero;
+        if (!_mm256_testz_si256(sea, sea))
+        {
+            __m256i cs = cs0, inc, v, take;
+            inc = _mm256_and_si256(n00, one);
+            v = avx2Sel(n00, v00, one);
+            cs = avx2Sel(n00, avx2StepSeed(cs, vst), cs);
+
+            inc = _mm256_sub_epi64(inc, n20);
+            take = _mm256_or_si256(_mm256_cmpeq_epi64(inc, one), avx2IsZeroBits(cs, bit0));
+            v = avx2Sel(_mm256_and_si256(n20, take), v20, v);
+            cs = avx2Sel(n20, avx2StepSeed(cs, vst), cs);
+
+            inc = _mm256_sub_epi64(inc, n02);
+            take = _mm256_or_si256(_mm256_cmpeq_epi64(inc, one), _mm256_or_si256(
+                _mm256_and_si256(_mm256_cmpeq_epi64(inc, two), avx2IsZeroBits(cs, bit0)),
+                _mm256_and_si256(_mm256_cmpeq_epi64(inc, three), avx2IsZeroMod(cs, INV3, LIM3))));
+            v = avx2Sel(_mm256_and_si256(n02, take), v02, v);
+            cs = avx2Sel(n02, avx2StepSeed(cs, vst), cs);
+
+            inc = _mm256_sub_epi64(inc, n22);
+            take = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi64(inc, one),
+                    _mm256_and_si256(_mm256_cmpeq_epi64(inc, two), avx2IsZeroBits(cs, bit0))),
+                _mm256_or_si256(
+                    _mm256_and_si256(_mm256_cmpeq_epi64(inc, three), avx2IsZeroMod(cs, INV3, LIM3)),
+                    _mm256_and_si256(_mm256_cmpeq_epi64(inc, four), avx2IsZeroBits(cs, bits01))));
+            v = avx2Sel(_mm256_and_si256(n22, take), v22, v);
+            cs = avx2Sel(n22, avx2StepSeed(cs, vst), cs);
+
+            __m256i keep = _mm256_andnot_si256(_mm256_cmpeq_epi64(inc, zero),
+                _mm256_or_si256(_mm256_cmpeq_epi64(v, four), avx2IsZeroMod(cs, INV3, LIM3)));
+            land = _mm256_and_si256(keep, v);
+        }
+
+        // land cell: becomes ocean next to an ocean diagonal
+        __m256i shore = _mm256_andnot_si256(all, avx2IsZeroMod(cs0, INV5, LIM5));
+
+        __m256i res = _mm256_andnot_si256(shore, v11);
+        res = avx2Sel(f11, four, res);
+        res = avx2Sel(z11, land, res);
+        avx2Store4(dst + i, res);
+    }
+
+    return i;
+}
+
+
+//==============================================================================
+// AVX-512
+//==============================================================================
+
+TARGET_AVX512
+static inline __m512i avx512ZoomStep(__m512i cs, __m512i salt)
+{
+    __m512i t = _mm512_add_epi32(_mm512_mullo_epi32(cs, _mm512_set1_epi32(ZOOM_MUL)),
+                                 _mm512_set1_epi32(ZOOM_ADD));
+    return _mm512_add_epi32(_mm512_mullo_epi32(cs, t), salt);
+}
+
+TARGET_AVX512
+static inline void avx512StorePairs(int *dst, __m512i a, __m512i b)
+{
+    const __m512i lo = _mm512_setr_epi32(
+        0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+    const __m512i hi = _mm512_setr_epi32(
+        8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+    _mm512_storeu_si512(dst + 0, _mm512_permutex2var_epi32(a, lo, b));
+    _mm512_storeu_si512(dst + 16, _mm512_permutex2var_epi32(a, hi, b));
+}
+
+TARGET_AVX512
+static int zoomRowAVX512(const int *p0, const int *p1, int *b0, int *b1, int n,
+        int chunkX, int chunkZ, int ss, int st, int island)
+{
+    const __m512i vss = _mm512_set1_epi32(ss);
+    const __m512i vst = _mm512_set1_epi32(st);
+    const __m512i cz = _mm512_set1_epi32(chunkZ);
+    const __m512i bit = _mm512_set1_epi32(BIT24);
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i three = _mm512_set1_epi32(3);
+    __m512i cx = _mm512_add_epi32(_mm512_set1_epi32(chunkX), _mm512_setr_epi32(
+            0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30));
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16, cx = _mm512_add_epi32(cx, _mm512_set1_epi32(32)))
+    {
+        __m512i a = _mm512_loadu_si512(p0 + i);
+        __m512i c = _mm512_loadu_si512(p0 + i + 1);
+        __m512i b = _mm512_loadu_si512(p1 + i);
+        __m512i d = _mm512_loadu_si512(p1 + i + 1);
+
+        __m512i cs = _mm512_add_epi32(vss, cx);
+        cs = avx512ZoomStep(cs, cz);
+        cs = avx512ZoomStep(cs, cx);
+        cs = avx512ZoomStep(cs, cz);
+        __m512i vb = _mm512_mask_blend_epi32(_mm512_test_epi32_mask(cs, bit), a, b);
+
+        cs = avx512ZoomStep(cs, vst);
+        __m512i vc = _mm512_mask_blend_epi32(_mm512_test_epi32_mask(cs, bit), a, c);
+
+        __m512i r = _mm512_and_si512(_mm512_srli_epi32(avx512ZoomStep(cs, vst), 24), three);
+        __m512i vd = d;
+        vd = _mm512_mask_blend_epi32(_mm512_cmpeq_epi32_mask(r, _mm512_set1_epi32(2)), vd, b);
+        vd = _mm512_mask_blend_epi32(_mm512_cmpeq_epi32_mask(r, one), vd, c);
+        vd = _mm512_mask_blend_epi32(_mm512_cmpeq_epi32_mask(r, _mm512_setzero_si512()), vd, a);
+
+        if (!island)
+        {
+            // select4()
+            __m512i cv00 = _mm512_maskz_mov_epi32(_mm512_cmpeq_epi32_mask(a, c), one);
+            cv00 = _mm512_mask_add_epi32(cv00, _mm512_cmpeq_epi32_mask(a, b), cv00, one);
+            cv00 = _mm512_mask_add_epi32(cv00, _mm512_cmpeq_epi32_mask(a, d), cv00, one);
+            __m512i cv10 = _mm512_maskz_mov_epi32(_mm512_cmpeq_epi32_mask(c, b), one);
+            cv10 = _mm512_mask_add_epi32(cv10, _mm512_cmpeq_epi32_mask(c, d), cv10, one);
+            __m512i cv01 = _mm512_maskz_mov_epi32(_mm512_cmpeq_epi32_mask(b, d), one);
+
+            vd = _mm512_mask_blend_epi32(_mm512_cmpgt_epi32_mask(cv01, cv00), vd, b);
+            vd = _mm512_mask_blend_epi32(_mm512_cmpgt_epi32_mask(cv10, cv00), vd, c);
+            vd = _mm512_mask_blend_epi32(
+                _mm512_cmpgt_epi32_mask(cv00, cv10) & _mm512_cmpgt_epi32_mask(cv00, cv01),
+                vd, a);
+        }
+
+        avx512StorePairs(b0 + 2*i, a, vc);
+        avx512StorePairs(b1 + 2*i, vb, vd);
+    }
+
+    return i;
+}
+
+TARGET_AVX512
+static inline __m512i avx512StepSeed(__m512i s, __m512i salt)
+{
+    __m512i t = _mm512_add_epi64(_mm512_mullo_epi64(s, _mm512_set1_epi64(LCG_MUL)),
+                                 _mm512_set1_epi64(LCG_ADD));
+    return _mm512_add_epi64(_mm512_mullo_epi64(s, t), salt);
+}
+
+// mask of lanes where mcFirstIsZero(cs, mod) for mod = 3 or 5
+TARGET_AVX512
+static inline __mmask8 avx512IsZeroMod(__m512i cs, int64_t inv, int64_t lim)
+{
+    __m512i hi = _mm512_srai_epi64(cs, 44);
+    __m512i lo = _mm512_and_si512(_mm512_srli_epi64(cs, 24), _mm512_set1_epi64(0xfffff));
+    __m512i f = _mm512_add_epi64(_mm512_add_epi64(hi, lo), _mm512_set1_epi64(FOLD15));
+    f = _mm512_and_si512(_mm512_mul_epu32(f, _mm512_set1_epi64(inv)),
+                         _mm512_set1_epi64(0xffffffff));
+    return _mm512_cmple_epu64_mask(f, _mm512_set1_epi64(lim));
+}
+
+TARGET_AVX512
+static int addIslandRowAVX512(const int *vz0, const int *vz1, const int *vz2,
+        int *dst, int n, int x, int z, int64_t ss, int64_t st)
+{
+    const __m512i one = _mm512_set1_epi64(1);
+    const __m512i two = _mm512_set1_epi64(2);
+    const __m512i three = _mm512_set1_epi64(3);
+    const __m512i four = _mm512_set1_epi64(4);
+    const __m512i bit0 = _mm512_set1_epi64(1LL << 24);
+    const __m512i bits01 = _mm512_set1_epi64(3LL << 24);
+    const __m512i vst = _mm512_set1_epi64(st);
+    const __m512i vz = _mm512_set1_epi64(z);
+    __m512i vx = _mm512_add_epi64(_mm512_set1_epi64(x),
+            _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7));
+    __m512i d[POLY_DEG+1];
+    int poly = n / 8 >= POLY_MIN;
+    int i, k;
+
+    if (poly)
+    {
+        for (k = 0; k <= POLY_DEG; k++)
+        {
+            __m512i px = _mm512_add_epi64(vx, _mm512_set1_epi64(8 * k));
+            d[k] = _mm512_add_epi64(_mm512_set1_epi64(ss), px);
+            d[k] = avx512StepSeed(d[k], vz);
+            d[k] = avx512StepSeed(d[k], px);
+            d[k] = avx512StepSeed(d[k], vz);
+        }
+        for (k = 1; k <= POLY_DEG; k++)
+        {
+            int m;
+            for (m = POLY_DEG; m >= k; m--)
+                d[m] = _mm512_sub_epi64(d[m], d[m-1]);
+        }
+    }
+
+    for (i = 0; i + 8 <= n; i += 8, vx = _mm512_add_epi64(vx, _mm512_set1_epi64(8)))
+    {
+        __m512i cs0;
+        if (poly)
+        {
+            cs0 = d[0];
+            for (k = 0; k < POLY_DEG; k++)
+                d[k] = _mm512_add_epi64(d[k], d[k+1]);
+        }
+
+        __m512i v00 = _mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i*)(vz0 + i)));
+        __m512i v20 = _mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i*)(vz0 + i + 2)));
+        __m512i v02 = _mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i*)(vz2 + i)));
+        __m512i v22 = _mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i*)(vz2 + i + 2)));
+        __m512i v11 = _mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i*)(vz1 + i + 1)));
+
+        __mmask8 n00 = _mm512_test_epi64_mask(v00, v00);
+        __mmask8 n20 = _mm512_test_epi64_mask(v20, v20);
+        __mmask8 n02 = _mm512_test_epi64_mask(v02, v02);
+        __mmask8 n22 = _mm512_test_epi64_mask(v22, v22);
+        __mmask8 all = n00 & n20 & n02 & n22;
+        __mmask8 any = n00 | n20 | n02 | n22;
+        __mmask8 z11 = _mm512_testn_epi64_mask(v11, v11);
+        __mmask8 f11 = _mm512_cmpeq_epi64_mask(v11, four);
+
+        // cells that do not border a coast keep their value
+        __mmask8 coast = (z11 & any) | (__mmask8)~(z11 | f11 | all);
+        if (coast == 0)
+        {
+            _mm256_storeu_si256((__m256i*)(dst + i), _mm512_cvtepi64_epi32(v11));
+            continue;
+        }
+
+        if (!poly)
+        {
+            cs0 = _mm512_add_epi64(_mm512_set1_epi64(ss), vx);
+            cs0 = avx512StepSeed(cs0, vz);
+            cs0 = avx512StepSeed(cs0, vx);
+            cs0 = avx512StepSeed(cs0, vz);
+        }
+
+        // ocean cell: the land neighbours are counted in 'inc' and each of
+        // them advances the PRNG of its cell
+        __m512i land = _mm512_setzero_si512();
+        if (z11 & any)
+        {
+            __m512i cs = cs0, inc, v;
+            __mmask8 take;
+            inc = _mm512_maskz_mov_epi64(n00, one);
+            v = _mm512_mask_blend_epi64(n00, one, v00);
+            cs = _mm512_mask_mov_epi64(cs, n00, avx512StepSeed(cs, vst));
+
+            inc = _mm512_mask_add_epi64(inc, n20, inc, one);
+            take = _mm512_cmpeq_epi64_mask(inc, one) | _mm512_testn_epi64_mask(cs, bit0);
+            v = _mm512_mask_blend_epi64(n20 & take, v, v20);
+            cs = _mm512_mask_mov_epi64(cs, n20, avx512StepSeed(cs, vst));
+
+            inc = _mm512_mask_add_epi64(inc, n02, inc, one);
+            take = _mm512_cmpeq_epi64_mask(inc, one) |
+                (_mm512_cmpeq_epi64_mask(inc, two) & _mm512_testn_epi64_mask(cs, bit0)) |
+                (_mm512_cmpeq_epi64_mask(inc, three) & avx512IsZeroMod(cs, INV3, LIM3));
+            v = _mm512_mask_blend_epi64(n02 & take, v, v02);
+            cs = _mm512_mask_mov_epi64(cs, n02, avx512StepSeed(cs, vst));
+
+            inc = _mm512_mask_add_epi64(inc, n22, inc, one);
+            take = _mm512_cmpeq_epi64_mask(inc, one) |
+                (_mm512_cmpeq_epi64_mask(inc, two) & _mm512_testn_epi64_mask(cs, bit0)) |
+                (_mm512_cmpeq_epi64_mask(inc, three) & avx512IsZeroMod(cs, INV3, LIM3)) |
+                (_mm512_cmpeq_epi64_mask(inc, four) & _mm512_testn_epi64_mask(cs, bits01));
+            v = _mm512_mask_blend_epi64(n22 & take, v, v22);
+            cs = _mm512_mask_mov_epi64(cs, n22, avx512StepSeed(cs, vst));
+
+            __mmask8 keep = _mm512_test_epi64_mask(inc, inc) &
+                (_mm512_cmpeq_epi64_mask(v, four) | avx512IsZeroMod(cs, INV3, LIM3));
+            land = _mm512_maskz_mov_epi64(keep, v);
+        }
+
+        // land cell: becomes ocean next to an ocean diagonal
+        __mmask8 shore = ~all & avx512IsZeroMod(cs0, INV5, LIM5);
+
+        __m512i res = _mm512_maskz_mov_epi64((__mmask8)~shore, v11);
+        res = _mm512_mask_mov_epi64(res, f11, four);
+        res = _mm512_mask_mov_epi64(res, z11, land);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm512_cvtepi64_epi32(res));
+    }
+
+    return i;
+}
+
+
+#endif // SIMD_X86
+
+
+//==============================================================================
+// Kernels
+//==============================================================================
+
+int zoomRowSimd(const int *p0, const int *p1, int *b0, int *b1, int n,
+        int chunkX, int chunkZ, int ss, int st, int island)
+{
+    int i = 0;
+
+    // the narrower kernels continue where the wider ones stop
+    switch (getSimdLevel())
+    {
+#if SIMD_X86
+    case SIMD_AVX512:
+        i = zoomRowAVX512(p0, p1, b0, b1, n, chunkX, chunkZ, ss, st, island);
+        // fall through
+    case SIMD_AVX2:
+        i += zoomRowAVX2(p0+i, p1+i, b0+2*i, b1+2*i, n-i, chunkX+2*i, chunkZ, ss, st, island);
+        // fall through
+    case SIMD_SSE2:
+        i += zoomRowSSE2(p0+i, p1+i, b0+2*i, b1+2*i, n-i, chunkX+2*i, chunkZ, ss, st, island);
+#endif
+    }
+
+    return i;
+}
+
+int addIslandRowSimd(const int *vz0, const int *vz1, const int *vz2,
+        int *dst, int n, int x, int z, int64_t ss, int64_t st)
+{
+    int i = 0;
+
+    switch (getSimdLevel())
+    {
+#if SIMD_X86
+    case SIMD_AVX512:
+        i = addIslandRowAVX512(vz0, vz1, vz2, dst, n, x, z, ss, st);
+        // fall through
+    case SIMD_AVX2:
+        i += addIslandRowAVX2(vz0+i, vz1+i, vz2+i, dst+i, n-i, x+i, z, ss, st);
+#endif
+    }
+
+    return i;
+}
+
+int riverRowSimd(const int *vz0, const int *vz1, const int *vz2, int *dst, int n)
+{
+#if SIMD_X86
+    if (getSimdLevel() >= SIMD_AVX2)
+        return riverRowAVX2(vz0, vz1, vz2, dst, n);
+#endif
+    return 0;
+}
+
+int smoothRowSimd(const int *vz0, const int *vz1, const int *vz2, int *dst,
+        int n, int x, int z, int64_t ss)
+{
+#if SIMD_X86
+    if (getSimdLevel() >= SIMD_AVX2)
+        return smoothRowAVX2(vz0, vz1, vz2, dst, n, x, z, ss);
+#endif
+    return 0;
+}
+
+int deepOceanRowSimd(const int *vz0, const int *vz1, const int *vz2, int *dst, int n)
+{
+#if SIMD_X86
+    if (getSimdLevel() >= SIMD_AVX2)
+        return deepOceanRowAVX2(vz0, vz1, vz2, dst, n);
+#endif
+    return 0;
+}
+
+int biomeEdgeRowSimd(const int *vz0, const int *vz1, const int *vz2, int *dst, int n)
+{
+#if SIMD_X86
+    if (getSimdLevel() >= SIMD_AVX2)
+        return biomeEdgeRowAVX2(vz0, vz1, vz2, dst, n);
+#endif
+    return 0;
+}
+
+int shoreRowSimd(const int *vz0, const int *vz1, const int *vz2, int *dst, int n)
+{
+#if SIMD_X86
+    if (getSimdLevel() >= SIMD_AVX2)
+        return shoreRowAVX2(vz0, vz1, vz2, dst, n);
+#endif
+    return 0;
+}
+
+int voronoiBlockSimd(int *blk, const int *cx, const int *cy, const int *cz,
+        const int *cv)
+{
+#if SIMD_X86
+    if (getSimdLevel() >= SIMD_AVX2)
+    {
+        voronoiBlockAVX2(blk, cx, cy, cz, cv);
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+int voronoi114BlockSimd(int *p, int stride, const int64_t *off, const int *cv)
+{
+#if SIMD_X86
+    if (getSimdLevel() >= SIMD_AVX2)
+    {
+        voronoi114BlockAVX2(p, stride, off, cv);
+        return 1;
+    }
+#endif
+    return 0;
+}
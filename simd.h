@@ -0,0 +1,98 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#include <stdint.h>
+
+/* Vectorized kernels for the hot layers. Each kernel processes whole vectors
+ * of cells at the start of a row and returns the number of cells it handled,
+ * leaving the remainder to the scalar code of the layer, which remains the
+ * reference implementation. The results are bit-identical to the scalar code.
+ *
+ * The instruction set is selected at runtime from what the CPU supports, so
+ * one build of the library runs on any x86-64 processor.
+ */
+
+enum
+{
+    SIMD_NONE,      // scalar code only
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512,    // AVX-512F with AVX-512DQ
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Builds the biome property tables of the kernels. This is done by
+ * initBiomes(), which has to be called before any generation anyway.
+ */
+void initSimdTables(void);
+
+/* Returns the highest instruction set level supported by the CPU. */
+int getSimdSupport(void);
+
+/* Returns the instruction set level currently used by the kernels. */
+int getSimdLevel(void);
+
+/* Selects the instruction set level for the kernels, for example to compare
+ * against the scalar code. A negative level selects the best supported one.
+ * The level is capped at what the CPU supports, and the level that is in use
+ * afterwards is returned.
+ */
+int setSimdLevel(int level);
+
+/* Inner loop of mapZoom() and mapZoomIsland() for one row of parent cells.
+ * 'p0' and 'p1' point at parent rows j and j+1, and 'b0' and 'b1' at the two
+ * output rows. 'chunkX' and 'chunkZ' are the chunk coordinates of the first
+ * cell and 'ss','st' are the truncated layer seeds. Returns the number of
+ * processed cells, which is a multiple of the vector size that is at most 'n'.
+ * The parent cells up to p0[n] and p1[n] have to be readable.
+ */
+int zoomRowSimd(const int *p0, const int *p1, int *b0, int *b1, int n,
+        int chunkX, int chunkZ, int ss, int st, int island);
+
+/* Inner loop of mapAddIsland() for one output row. 'vz0', 'vz1' and 'vz2' are
+ * the parent rows j, j+1 and j+2 (each two cells wider than the output) and
+ * 'dst' is the output row, which may overlap with 'vz0'. The output cell 'i'
+ * is at position (x+i, z) and 'ss','st' are the layer seeds. Returns the
+ * number of processed cells. The seeds need 64-bit lanes, so there are
+ * kernels for AVX-512 and AVX2 (which builds the 64-bit multiplies from
+ * 32-bit ones), but not for SSE2, which only has two such lanes per vector.
+ */
+int addIslandRowSimd(const int *vz0, const int *vz1, const int *vz2,
+        int *dst, int n, int x, int z, int64_t ss, int64_t st);
+
+/* Inner loops of the layers that apply compare/select rules to the cross of
+ * neighbours around each cell. The arguments are as for addIslandRowSimd(),
+ * and mapSmooth also needs the start seed 'ss' of the layer for its rare
+ * random choices. These kernels require AVX2.
+ */
+int riverRowSimd(const int *vz0, const int *vz1, const int *vz2, int *dst, int n);
+int smoothRowSimd(const int *vz0, const int *vz1, const int *vz2, int *dst,
+        int n, int x, int z, int64_t ss);
+int deepOceanRowSimd(const int *vz0, const int *vz1, const int *vz2, int *dst, int n);
+int biomeEdgeRowSimd(const int *vz0, const int *vz1, const int *vz2, int *dst, int n);
+int shoreRowSimd(const int *vz0, const int *vz1, const int *vz2, int *dst, int n);
+
+/* Resolves the 4x4 block of cells of mapVoronoiZoom() for one parent cell
+ * into 'blk' (row by row). The eight candidate cells are in the order of the
+ * scalar code, with their jitter in 'cx','cy','cz' and their biome in 'cv'.
+ * Returns zero if there is no kernel for the current level.
+ */
+int voronoiBlockSimd(int *blk, const int *cx, const int *cy, const int *cz,
+        const int *cv);
+
+/* Resolves the 4x4 block of cells of mapVoronoiZoom114() for one parent cell
+ * at 'p' with the row stride 'stride'. 'off' holds the (x,z) offsets of the
+ * four corners (a,b,c,d) and 'cv' their biomes. Returns zero if there is no
+ * kernel for the current level.
+ */
+int voronoi114BlockSimd(int *p, int stride, const int64_t *off, const int *cv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMD_H_ */